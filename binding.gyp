@@ -6,14 +6,64 @@
           "sources": [
               "./src/hash.cc",
               "./src/json.cc",
+              "./src/sax.cc",
+              "./src/builder.cc",
+              "./src/phash.cc",
               "./src/crc32.cc",
-              "./src/mempool.cc",
+              "./src/arena.cc",
               "./src/shm.cc",
+              "./src/image.cc",
+              "./src/registry.cc",
+              "./src/once.cc",
+              "./src/wrapcache.cc",
+              "./src/path.cc",
 			  "./src/semaphore.cc",
 			  "./src/bitmap.cc",
 			  "./src/error.cc",
               "./src/jss.cc"
+          ],
+          "conditions": [
+              [ 'OS=="linux"', { "libraries": [ '-lrt' ] } ]
           ]
       }
+  ],
+  "conditions": [
+      [ 'OS!="win"', {
+          "targets": [
+              {
+                  "target_name": "jssc",
+                  "type": "executable",
+                  "cflags_cc": [ '-fexceptions' ],
+                  "sources": [
+                      "./src/hash.cc",
+                      "./src/json.cc",
+                      "./src/sax.cc",
+                      "./src/builder.cc",
+                      "./src/phash.cc",
+                      "./src/crc32.cc",
+                      "./src/arena.cc",
+                      "./src/image.cc",
+                      "./src/bitmap.cc",
+                      "./src/error.cc",
+                      "./src/jssc.cc"
+                  ]
+              },
+              {
+                  "target_name": "jssadm",
+                  "type": "executable",
+                  "sources": [
+                      "./src/hash.cc",
+                      "./src/shm.cc",
+                      "./src/once.cc",
+                      "./src/registry.cc",
+                      "./src/error.cc",
+                      "./src/jssadm.cc"
+                  ],
+                  "conditions": [
+                      [ 'OS=="linux"', { "libraries": [ '-lrt' ] } ]
+                  ]
+              }
+          ]
+      } ]
   ]
 }
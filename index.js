@@ -3,10 +3,30 @@ var fs = require('fs');
 
 exports.createJssByJsonFile = createJssByJsonFile;
 exports.createJssByJsonStr = createJssByJsonStr;
+exports.createJssByImageFile = createJssByImageFile;
+exports.saveJssImage = saveJssImage;
+exports.open = open;
+exports.list = list;
+exports.warmup = warmup;
+// get(obj, path[, index...]): the value at path ('monsters[120].drops[2].itemId')
+// below obj, a jss object or anything read from it, in one native call with
+// nothing made for the steps between; each [*] in path takes the next index.
+// compilePath(path) parses a path once for hot lookups:
+//   var drop = jss.compilePath('monsters[*].drops[*].itemId');
+//   jss.get(data, drop, 120, 2);
+// Both throw on a malformed path, and get() on missing indexes
+exports.get = jss.get;
+exports.compilePath = jss.compilePath;
 
-function createJssByJsonStr(jstr, size) {
+// options: { shm: 'posix' (default) or 'sysv', hugepages: false,
+//            image: segment image path, see createJssByJsonFile(),
+//            name: shares the registry regions under this name, see open(),
+//            prefault: true faults every page in from a background thread,
+//                      'sync' before returning, see warmup(),
+//            mlock: keeps the pages resident, needs RLIMIT_MEMLOCK }
+function createJssByJsonStr(jstr, options) {
 	try {
-		var obj = jss.createJssObject(jstr);
+		var obj = jss.createJssObject(jstr, options || {});
 		return obj;
 	} catch(e) {
 		console.error('[fo3-jss] '+e);
@@ -14,15 +34,81 @@ function createJssByJsonStr(jstr, size) {
 	}
 }
 
-function createJssByJsonFile(file) {
+// with options.image, an image at least as new as file is mapped instead of
+// parsing file, and a freshly built segment is saved there for next time
+function createJssByJsonFile(file, options) {
 	var stats = fs.statSync(file);
+	var image = options && options.image;
+	var obj;
+
+	if (image && fs.existsSync(image) && fs.statSync(image).mtime >= stats.mtime) {
+		obj = createJssByImageFile(image, options);
+		if (obj) return obj;
+	}
 
 	var jstr = fs.readFileSync(file).toString();
-	var obj = createJssByJsonStr(jstr);
+	obj = createJssByJsonStr(jstr, options);
 
 	if (!obj) {
 		console.error('[fo3-jss] '+file);
 		obj = require(file);
+	} else if (image) {
+		saveJssImage(obj, image);
 	}
 	return obj;
-}
\ No newline at end of file
+}
+
+// options: prefault and mlock as for createJssByJsonStr()
+function createJssByImageFile(file, options) {
+	try {
+		return jss.openImage(file, options || {});
+	} catch(e) {
+		console.error('[fo3-jss] '+e+' '+file);
+		return;
+	}
+}
+
+function saveJssImage(obj, file) {
+	try {
+		jss.saveImage(obj, file);
+		return true;
+	} catch(e) {
+		console.error('[fo3-jss] '+e+' '+file);
+		return false;
+	}
+}
+
+// a dataset some process created with options.name, undefined if none did.
+// Creating it again under the same name publishes a new version: the object
+// returned here moves to it, objects already read from it stay as they were
+function open(name, options) {
+	try {
+		return jss.open(name, options || {});
+	} catch(e) {
+		console.error('[fo3-jss] '+e+' '+name);
+		return;
+	}
+}
+
+// what the registry knows of, as { type: 'dataset'|'segment', name, size,
+// owners: [pid], created, lastAttach }; processes that died are swept first.
+// jssadm evicts what nobody holds
+function list() {
+	try {
+		return jss.list();
+	} catch(e) {
+		console.error('[fo3-jss] '+e);
+		return [];
+	}
+}
+
+// { total, done: bytes, ready, locked } of obj being faulted in, for a
+// readiness probe to wait on; undefined unless obj was created with prefault
+function warmup(obj) {
+	try {
+		return jss.warmup(obj);
+	} catch(e) {
+		console.error('[fo3-jss] '+e);
+		return;
+	}
+}
@@ -0,0 +1,65 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "arena.h"
+
+arena_t* arena_create(void *source, size_t size)
+{
+	void *source_ = source;
+	arena_t *arena = NULL;
+
+	if (!size)
+		return NULL;
+
+	for (;;) {
+		arena = (arena_t*) calloc(1, sizeof(arena_t));
+		if (!arena) break;
+
+		if (!source_)
+			source_ = calloc(1, size);
+		if (!source_) break;
+
+		arena->source = source_;
+		arena->size = size;
+		arena->used = 0;
+		if (!source) arena->free = true;
+
+		return arena;
+	}
+
+	if (arena) free(arena);
+
+	return NULL;
+}
+
+/*
+ * align must be a power of 2 and is applied to the absolute address, so
+ * the source itself does not need to be aligned.
+ */
+void* arena_alloc(arena_t *arena, size_t size, size_t align)
+{
+	uintptr_t base, at;
+
+	if (!arena || !size || !align)
+		return NULL;
+
+	base = (uintptr_t) arena->source;
+	at = (base + arena->used + align - 1) & ~((uintptr_t) align - 1);
+	if (at + size > base + arena->size) {
+		errprint("arena full: used(%lu), size(%lu), request(%lu)", arena->used, arena->size, size);
+		return NULL;
+	}
+
+	arena->used = at + size - base;
+
+	return (void*) at;
+}
+
+void arena_del(arena_t *arena)
+{
+	if (!arena) return;
+	if (arena->free) free(arena->source);
+	free(arena);
+}
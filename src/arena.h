@@ -0,0 +1,30 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+/**
+ Bump allocator for write-once data: no per allocation header, no free list.
+
+ arena_t *arena = arena_create(NULL, 1024*1024);
+ void *at1 = arena_alloc(arena, 24, ARENA_ALIGN_8);
+ void *at2 = arena_alloc(arena, 64, ARENA_ALIGN_16);
+ arena_del(arena);
+ */
+
+#define ARENA_ALIGN_1	1
+#define ARENA_ALIGN_8	8
+#define ARENA_ALIGN_16	16
+
+typedef struct arena_t {
+	size_t size;
+	size_t used;
+	void *source;
+	bool free;
+} arena_t;
+
+arena_t* arena_create(void *source, size_t size);
+void* arena_alloc(arena_t *arena, size_t size, size_t align);
+void arena_del(arena_t *arena);
+
+#endif
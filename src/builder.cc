@@ -0,0 +1,664 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "sax.h"
+#include "builder.h"
+
+static void* alloc(builder_t *b, size_t size)
+{
+	void *p = b->userset->memalloc(1, size, b->userset->userdata);
+
+	if (!p) b->full = 1;
+	return p;
+}
+
+/*
+ * The UTF-16 code units of str the way node decodes UTF-8: a malformed
+ * sequence becomes one U+FFFD for its longest valid start, or for its first
+ * byte. Stored to out unless it is NULL. Returns how many.
+ */
+static unsigned int utf16_encode(const char *str, unsigned int length, uint16_t *out)
+{
+	const unsigned char *p = (const unsigned char *) str, *end = p + length;
+	unsigned int c, n, i, units = 0;
+	unsigned char lower, upper;
+
+	while (p < end) {
+		c = *p;
+		lower = 0x80;
+		upper = 0xBF;
+		if (c < 0x80) { n = 0; }
+		else if (c >= 0xC2 && c <= 0xDF) { n = 1; c &= 0x1F; }
+		else if (c >= 0xE0 && c <= 0xEF) {
+			n = 2;
+			if (c == 0xE0) lower = 0xA0;
+			if (c == 0xED) upper = 0x9F;		/* no surrogates */
+			c &= 0x0F;
+		}
+		else if (c >= 0xF0 && c <= 0xF4) {
+			n = 3;
+			if (c == 0xF0) lower = 0x90;
+			if (c == 0xF4) upper = 0x8F;		/* up to U+10FFFF */
+			c &= 0x07;
+		}
+		else { n = 0; c = 0xFFFD; }
+
+		for (i = 1; i <= n; i++) {
+			if (p + i == end || p[i] < lower || p[i] > upper)
+				break;
+			c = (c << 6) | (p[i] & 0x3F);
+			lower = 0x80;
+			upper = 0xBF;
+		}
+		if (i <= n) {
+			c = 0xFFFD;
+			n = i - 1;
+		}
+		p += n + 1;
+
+		if (c >= 0x10000) {
+			if (out) {
+				out[units] = 0xD800 | ((c - 0x10000) >> 10);
+				out[units + 1] = 0xDC00 | (c & 0x3FF);
+			}
+			units += 2;
+		} else {
+			if (out) out[units] = (uint16_t) c;
+			units++;
+		}
+	}
+	return units;
+}
+
+/* JSS_STRING_* flags of str, and its length in UTF-16 code units */
+static unsigned int string_form(const char *str, unsigned int length, unsigned int *units)
+{
+	unsigned int i;
+
+	for (i = 0; i < length && !(str[i] & 0x80); i++);
+	if (i == length) {
+		*units = length;
+		return JSS_STRING_ASCII;
+	}
+	*units = utf16_encode(str, length, NULL);
+	return length >= JSS_STRING_WIDE_MIN ? JSS_STRING_UTF16 : 0;
+}
+
+/* Returns the segment copy of str, allocating it on first use. */
+static jss_string_t* intern(builder_t *b, const char *str, unsigned int length)
+{
+	builder_string_t *p;
+	jss_string_t *s;
+	uint64_t h = hash64(str, length) | 1;
+	unsigned int i, n, size, flags, units;
+
+	/* keep the table at most half full */
+	if ((b->string_count + 1) * 2 > b->string_size) {
+		size = b->string_size ? b->string_size << 1 : 1024;
+		p = (builder_string_t *) calloc(size, sizeof(builder_string_t));
+		if (!p) return NULL;
+		for (i = 0; i < b->string_size; i++) {
+			if (!b->strings[i].hash)
+				continue;
+			for (n = (unsigned int) b->strings[i].hash & (size - 1); p[n].hash; n = (n + 1) & (size - 1));
+			p[n] = b->strings[i];
+		}
+		free(b->strings);
+		b->strings = p;
+		b->string_size = size;
+	}
+
+	for (n = (unsigned int) h & (b->string_size - 1); b->strings[n].hash; n = (n + 1) & (b->string_size - 1)) {
+		s = b->strings[n].string;
+		if (b->strings[n].hash == h && s->length == length && !memcmp(s->data, str, length))
+			return s;
+	}
+
+	flags = string_form(str, length, &units);
+	s = (jss_string_t *) alloc(b, jss_string_bytes(length, units, flags));
+	if (!s) return NULL;
+
+	s->length = length;
+	s->flags = flags;
+	s->units = units;
+	memcpy(s->data, str, length);
+	s->data[length] = '\0';
+	if (flags & JSS_STRING_UTF16)
+		utf16_encode(str, length, (uint16_t *) jss_string_utf16(s));
+
+	b->strings[n].hash = h;
+	b->strings[n].string = s;
+	b->string_count++;
+	return s;
+}
+
+static int push_entry(builder_t *b, jss_value_t value)
+{
+	jss_value_t *p;
+	unsigned int n;
+
+	if (b->count == b->size) {
+		n = b->size ? b->size << 1 : 1024;
+		p = (jss_value_t *) realloc(b->entries, n * sizeof(jss_value_t));
+		if (!p) return 0;
+		b->entries = p;
+		b->size = n;
+	}
+	b->entries[b->count++] = value;
+	return 1;
+}
+
+static int push_frame(builder_t *b)
+{
+	unsigned int *p;
+	unsigned int n;
+
+	if (b->depth == b->frame_size) {
+		n = b->frame_size ? b->frame_size << 1 : 64;
+		p = (unsigned int *) realloc(b->frames, n * sizeof(unsigned int));
+		if (!p) return 0;
+		b->frames = p;
+		b->frame_size = n;
+	}
+	b->frames[b->depth++] = b->count;
+	return 1;
+}
+
+/* a finished value belongs to the innermost open container, or is the root */
+static int add_value(builder_t *b, jss_value_t value)
+{
+	if (!b->depth) {
+		b->root = value;
+		return 1;
+	}
+	return push_entry(b, value);
+}
+
+/* out-of-line payload, returns JSS_NONE when the segment is full */
+static jss_value_t add_record(builder_t *b, int type, const void *data, size_t size)
+{
+	void *p = alloc(b, size);
+
+	if (!p) {
+		errprint("alloc fail");
+		return JSS_NONE;
+	}
+	memcpy(p, data, size);
+	return jss_make(type, JSS_OFFSET(b->header, p));
+}
+
+static int on_begin(void *userdata)
+{
+	return push_frame((builder_t *) userdata);
+}
+
+static int on_key(void *userdata, const char *key, unsigned int length)
+{
+	builder_t *b = (builder_t *) userdata;
+	jss_string_t *str = intern(b, key, length);
+
+	return str && push_entry(b, JSS_OFFSET(b->header, str));
+}
+
+/*
+ * Spreads the values of the object being closed over the slots of shape,
+ * into b->row. Repeated keys keep the first value, like hash_insert() did.
+ * Returns the number of keys placed, or -1 if a key is not in the shape.
+ */
+static int fill_row(builder_t *b, jss_shape_t *shape, unsigned int start, unsigned int len)
+{
+	jss_value_t *p;
+	unsigned int i, n, slot, placed = 0;
+
+	if (shape->size > b->row_size) {
+		for (n = b->row_size ? b->row_size : 64; n < shape->size; n <<= 1);
+		p = (jss_value_t *) realloc(b->row, n * sizeof(jss_value_t));
+		if (!p) return -1;
+		b->row = p;
+		b->row_size = n;
+	}
+	memset(b->row, 0, shape->size * sizeof(jss_value_t));
+
+	for (i = 0; i < len; i++) {
+		slot = phash_slot(b->hashes[i], jss_shape_disp(shape), shape->buckets, shape->size);
+		if (shape->keys[slot] != (int64_t) b->entries[start + 2*i])
+			return -1;
+		if (b->row[slot] != JSS_NONE)
+			continue;
+		b->row[slot] = b->entries[start + 2*i + 1];
+		placed++;
+	}
+	return placed;
+}
+
+/* freezes the key set of the object being closed into a new shape */
+static jss_shape_t* add_shape(builder_t *b, unsigned int start, unsigned int len, uint64_t setkey)
+{
+	builder_shape_t *p;
+	jss_shape_t *shape;
+	phash_t *ph;
+	unsigned int i, n, size, unique = 0;
+
+	/* keep the table at most half full */
+	if ((b->shape_count + 1) * 2 > b->shape_size) {
+		size = b->shape_size ? b->shape_size << 1 : 256;
+		p = (builder_shape_t *) calloc(size, sizeof(builder_shape_t));
+		if (!p) return NULL;
+		for (i = 0; i < b->shape_size; i++) {
+			if (!b->shapes[i].shape)
+				continue;
+			for (n = (unsigned int) b->shapes[i].setkey & (size - 1); p[n].shape; n = (n + 1) & (size - 1));
+			p[n] = b->shapes[i];
+		}
+		free(b->shapes);
+		b->shapes = p;
+		b->shape_size = size;
+	}
+
+	ph = phash_create(b->hashes, len);
+	if (!ph) return NULL;
+
+	shape = (jss_shape_t *) alloc(b, jss_shape_bytes(ph->size, ph->buckets));
+	if (!shape) {
+		phash_del(ph);
+		return NULL;
+	}
+
+	shape->size = ph->size;
+	shape->buckets = ph->buckets;
+	memcpy(jss_shape_disp(shape), ph->disp, ph->buckets * sizeof(uint32_t));
+	for (i = 0; i < len; i++) {
+		if (ph->slots[i] == PHASH_DUPLICATE)
+			continue;
+		shape->keys[ph->slots[i]] = (int64_t) b->entries[start + 2*i];
+		unique++;
+	}
+	shape->length = unique;
+	phash_del(ph);
+
+	for (n = (unsigned int) setkey & (b->shape_size - 1); b->shapes[n].shape; n = (n + 1) & (b->shape_size - 1));
+	b->shapes[n].setkey = setkey;
+	b->shapes[n].shape = shape;
+	b->shape_count++;
+
+	return shape;
+}
+
+static int on_end_object(void *userdata)
+{
+	builder_t *b = (builder_t *) userdata;
+	unsigned int start = b->frames[--b->depth];
+	unsigned int len = (b->count - start) / 2;
+	unsigned int i, n;
+	jss_object_t *object;
+	jss_shape_t *shape = NULL;
+	jss_string_t *key;
+	uint64_t *p, setkey = 0;
+	int placed = -1;
+
+	if (len > b->hash_size) {
+		for (n = b->hash_size ? b->hash_size : 64; n < len; n <<= 1);
+		p = (uint64_t *) realloc(b->hashes, n * sizeof(uint64_t));
+		if (!p) return 0;
+		b->hashes = p;
+		b->hash_size = n;
+	}
+	/* the key set is hashed regardless of key order */
+	for (i = 0; i < len; i++) {
+		key = (jss_string_t *) JSS_PTR(b->header, (int64_t) b->entries[start + 2*i]);
+		b->hashes[i] = phash_hash(key->data, key->length);
+		setkey += b->hashes[i];
+	}
+
+	/* reuse a shape with exactly these keys */
+	for (n = b->shape_size ? (unsigned int) setkey & (b->shape_size - 1) : 0;
+		 b->shape_size && b->shapes[n].shape; n = (n + 1) & (b->shape_size - 1)) {
+		if (b->shapes[n].setkey != setkey)
+			continue;
+		placed = fill_row(b, b->shapes[n].shape, start, len);
+		if (placed >= 0 && (unsigned int) placed == b->shapes[n].shape->length) {
+			shape = b->shapes[n].shape;
+			break;
+		}
+	}
+
+	if (!shape) {
+		shape = add_shape(b, start, len, setkey);
+		if (!shape) return 0;
+
+		/* keys are interned, so anything else sharing a hash is a real collision */
+		if (fill_row(b, shape, start, len) < 0) {
+			errprint("64 bit key hash collision");
+			return 0;
+		}
+	}
+
+	object = (jss_object_t *) alloc(b, sizeof(jss_object_t) + shape->size*sizeof(jss_value_t));
+	if (!object) return 0;
+
+	object->shape = JSS_OFFSET(b->header, shape);
+	memcpy(object->values, b->row, shape->size*sizeof(jss_value_t));
+	b->count = start;
+
+	return add_value(b, jss_make(JSS_OBJECT, JSS_OFFSET(b->header, object)));
+}
+
+static int on_end_array(void *userdata)
+{
+	builder_t *b = (builder_t *) userdata;
+	unsigned int start = b->frames[--b->depth];
+	unsigned int len = b->count - start;
+	jss_array_t *array;
+
+	array = (jss_array_t *) alloc(b, sizeof(jss_array_t) + len*sizeof(jss_value_t));
+	if (!array) return 0;
+
+	array->length = len;
+	memcpy(array->values, b->entries + start, len*sizeof(jss_value_t));
+	b->count = start;
+
+	return add_value(b, jss_make(JSS_ARRAY, JSS_OFFSET(b->header, array)));
+}
+
+static int on_string(void *userdata, const char *str, unsigned int length)
+{
+	builder_t *b = (builder_t *) userdata;
+	jss_string_t *s;
+
+	if (length <= JSS_SSTR_MAX)
+		return add_value(b, jss_make_sstr(str, length));
+
+	s = intern(b, str, length);
+	if (!s) return 0;
+
+	return add_value(b, jss_make(JSS_STRING, JSS_OFFSET(b->header, s)));
+}
+
+static int on_integer(void *userdata, json_int_t value)
+{
+	builder_t *b = (builder_t *) userdata;
+	jss_value_t v;
+
+	if (value >= JSS_INT_MIN && value <= JSS_INT_MAX)
+		return add_value(b, jss_make(JSS_INT, value));
+
+	v = add_record(b, JSS_BIGINT, &value, sizeof(value));
+	return v != JSS_NONE && add_value(b, v);
+}
+
+static int on_double(void *userdata, double value)
+{
+	builder_t *b = (builder_t *) userdata;
+	jss_value_t v = add_record(b, JSS_DOUBLE, &value, sizeof(value));
+
+	return v != JSS_NONE && add_value(b, v);
+}
+
+static int on_boolean(void *userdata, int value)
+{
+	return add_value((builder_t *) userdata, value ? JSS_TRUE : JSS_FALSE);
+}
+
+static int on_null(void *userdata)
+{
+	return add_value((builder_t *) userdata, JSS_NULL);
+}
+
+/*
+ * Sizing pass: walks the document with the same rules as the builder and
+ * adds up what every record will take in the arena. Interned strings and
+ * key sets are deduplicated by their 64 bit hash, so a collision could
+ * only make the estimate smaller; builder_measure() leaves headroom for
+ * that and for perfect hashes that needed more slots than keys.
+ */
+typedef struct measure_t {
+	size_t bytes;
+
+	uint64_t *seen;				/* hashes of strings and key sets already counted */
+	unsigned int seen_count;
+	unsigned int seen_size;
+
+	unsigned int *counts;		/* values in each open container */
+	uint64_t *setkeys;			/* key set hash of each open object */
+	unsigned int depth;
+	unsigned int frame_size;
+} measure_t;
+
+#define ALIGN8(n)	(((n) + 7) & ~((size_t) 7))
+
+/* 1 if h is new, 0 if it was seen before, -1 out of memory */
+static int see(measure_t *m, uint64_t h)
+{
+	uint64_t *p;
+	unsigned int i, n, size, mask;
+
+	if (!h) h = 1;				/* 0 marks an empty slot */
+
+	if ((m->seen_count + 1) * 2 > m->seen_size) {
+		size = m->seen_size ? m->seen_size << 1 : 1024;
+		p = (uint64_t *) calloc(size, sizeof(uint64_t));
+		if (!p) return -1;
+		for (i = 0; i < m->seen_size; i++) {
+			if (!m->seen[i])
+				continue;
+			for (n = (unsigned int) m->seen[i] & (size - 1); p[n]; n = (n + 1) & (size - 1));
+			p[n] = m->seen[i];
+		}
+		free(m->seen);
+		m->seen = p;
+		m->seen_size = size;
+	}
+
+	mask = m->seen_size - 1;
+	for (i = (unsigned int) h & mask; m->seen[i]; i = (i + 1) & mask) {
+		if (m->seen[i] == h)
+			return 0;
+	}
+	m->seen[i] = h;
+	m->seen_count++;
+	return 1;
+}
+
+static int measure_string(measure_t *m, const char *str, unsigned int length)
+{
+	int fresh = see(m, hash64(str, length));
+	unsigned int flags, units;
+
+	if (fresh < 0)
+		return 0;
+	if (fresh) {
+		flags = string_form(str, length, &units);
+		m->bytes += ALIGN8(jss_string_bytes(length, units, flags));
+	}
+	return 1;
+}
+
+static int measure_value(measure_t *m, size_t bytes)
+{
+	m->bytes += bytes;
+	if (m->depth)
+		m->counts[m->depth - 1]++;
+	return 1;
+}
+
+static int measure_begin(void *userdata)
+{
+	measure_t *m = (measure_t *) userdata;
+	unsigned int *counts;
+	uint64_t *setkeys;
+	unsigned int n;
+
+	if (m->depth == m->frame_size) {
+		n = m->frame_size ? m->frame_size << 1 : 64;
+		counts = (unsigned int *) realloc(m->counts, n * sizeof(unsigned int));
+		if (!counts) return 0;
+		m->counts = counts;
+		setkeys = (uint64_t *) realloc(m->setkeys, n * sizeof(uint64_t));
+		if (!setkeys) return 0;
+		m->setkeys = setkeys;
+		m->frame_size = n;
+	}
+	m->counts[m->depth] = 0;
+	m->setkeys[m->depth] = 0;
+	m->depth++;
+	return 1;
+}
+
+static int measure_key(void *userdata, const char *key, unsigned int length)
+{
+	measure_t *m = (measure_t *) userdata;
+
+	m->setkeys[m->depth - 1] += phash_hash(key, length);
+	return measure_string(m, key, length);
+}
+
+static int measure_end_object(void *userdata)
+{
+	measure_t *m = (measure_t *) userdata;
+	unsigned int n = m->counts[--m->depth];
+	unsigned int slots = n ? n : 1;		/* phash_create() never makes an empty table */
+	/* key sets share the table with strings, keep them apart */
+	int fresh = see(m, m->setkeys[m->depth] ^ 0x5348415045ULL);
+
+	if (fresh < 0)
+		return 0;
+	if (fresh)
+		m->bytes += ALIGN8(jss_shape_bytes(slots, n / 4 + 1));
+
+	return measure_value(m, ALIGN8(sizeof(jss_object_t) + slots*sizeof(jss_value_t)));
+}
+
+static int measure_end_array(void *userdata)
+{
+	measure_t *m = (measure_t *) userdata;
+	unsigned int n = m->counts[--m->depth];
+
+	return measure_value(m, ALIGN8(sizeof(jss_array_t) + n*sizeof(jss_value_t)));
+}
+
+static int measure_str(void *userdata, const char *str, unsigned int length)
+{
+	measure_t *m = (measure_t *) userdata;
+
+	if (length > JSS_SSTR_MAX && !measure_string(m, str, length))
+		return 0;
+	return measure_value(m, 0);
+}
+
+static int measure_integer(void *userdata, json_int_t value)
+{
+	int big = value < JSS_INT_MIN || value > JSS_INT_MAX;
+
+	return measure_value((measure_t *) userdata, big ? sizeof(json_int_t) : 0);
+}
+
+static int measure_double(void *userdata, double)
+{
+	return measure_value((measure_t *) userdata, sizeof(double));
+}
+
+static int measure_boolean(void *userdata, int)
+{
+	return measure_value((measure_t *) userdata, 0);
+}
+
+static int measure_null(void *userdata)
+{
+	return measure_value((measure_t *) userdata, 0);
+}
+
+int builder_measure(const char *json, size_t length, size_t *bytes, char *error)
+{
+	sax_handler_t handler;
+	measure_t m;
+	int ok;
+
+	memset(&m, 0, sizeof(m));
+	memset(&handler, 0, sizeof(handler));
+	handler.begin_object = measure_begin;
+	handler.object_key = measure_key;
+	handler.end_object = measure_end_object;
+	handler.begin_array = measure_begin;
+	handler.end_array = measure_end_array;
+	handler.string = measure_str;
+	handler.integer = measure_integer;
+	handler.dbl = measure_double;
+	handler.boolean = measure_boolean;
+	handler.null = measure_null;
+	handler.userdata = &m;
+
+	ok = sax_parse(&handler, json, length, error);
+	if (ok) {
+		/* headroom for hash collisions and grown perfect hashes */
+		*bytes = m.bytes + m.bytes / 64 + 4096;
+	}
+
+	free(m.seen);
+	free(m.counts);
+	free(m.setkeys);
+	return ok;
+}
+
+builder_t* builder_create(jss_header_t *header, hash_userset_t *userset)
+{
+	builder_t *b;
+
+	if (!header || !userset)
+		return NULL;
+
+	b = (builder_t *) calloc(1, sizeof(builder_t));
+	if (!b) return NULL;
+
+	b->header = header;
+	b->userset = userset;
+
+	return b;
+}
+
+int builder_parse(builder_t *b, const char *json, size_t length, jss_value_t *root, char *error)
+{
+	sax_handler_t handler;
+
+	memset(&handler, 0, sizeof(handler));
+	handler.begin_object = on_begin;
+	handler.object_key = on_key;
+	handler.end_object = on_end_object;
+	handler.begin_array = on_begin;
+	handler.end_array = on_end_array;
+	handler.string = on_string;
+	handler.integer = on_integer;
+	handler.dbl = on_double;
+	handler.boolean = on_boolean;
+	handler.null = on_null;
+	handler.userdata = b;
+
+	b->root = JSS_NONE;
+	b->count = b->depth = 0;
+	b->full = 0;
+
+	if (!sax_parse(&handler, json, length, error)) {
+		if (b->full)
+			sprintf(error, "Segment full");
+		return 0;
+	}
+
+	errprint("%u strings, %u shapes", b->string_count, b->shape_count);
+
+	*root = b->root;
+	return 1;
+}
+
+void builder_del(builder_t *b)
+{
+	if (!b) return;
+
+	free(b->entries);
+	free(b->frames);
+	free(b->strings);
+	free(b->hashes);
+	free(b->row);
+	free(b->shapes);
+	free(b);
+}
@@ -0,0 +1,70 @@
+#ifndef _BUILDER_H
+#define _BUILDER_H
+
+#include "hash.h"
+#include "jssdata.h"
+
+/**
+ Writes a JSON document straight into a segment while it is being parsed,
+ without an intermediate json_value tree.
+
+ builder_t *builder = builder_create(header, &userset);
+ jss_value_t root;
+ int ok = builder_parse(builder, json, length, &root, error);
+ builder_del(builder);
+
+ userset allocates inside the segment that starts at header. Only the
+ currently open containers are kept aside in process memory, along with
+ two tables that are dropped with the builder: interned keys and strings,
+ and the jss_shape_t of every key set seen, which objects with the same
+ keys share.
+ */
+
+typedef struct builder_string_t {
+	uint64_t hash;				/* hash64() of the bytes, 0 for a free slot */
+	jss_string_t *string;
+} builder_string_t;
+
+typedef struct builder_shape_t {
+	uint64_t setkey;			/* sum of the key hashes */
+	jss_shape_t *shape;
+} builder_shape_t;
+
+typedef struct builder_t {
+	jss_header_t *header;
+	hash_userset_t *userset;
+
+	jss_value_t *entries;		/* finished children of open containers */
+	unsigned int count;
+	unsigned int size;
+
+	unsigned int *frames;		/* first entry of each open container */
+	unsigned int depth;
+	unsigned int frame_size;
+
+	uint64_t *hashes;			/* key hashes of the object being frozen */
+	unsigned int hash_size;
+
+	builder_shape_t *shapes;	/* open addressing by setkey */
+	unsigned int shape_count;
+	unsigned int shape_size;
+
+	jss_value_t *row;			/* values of the object being frozen, by slot */
+	unsigned int row_size;
+
+	builder_string_t *strings;	/* open addressing by hash */
+	unsigned int string_count;
+	unsigned int string_size;
+
+	jss_value_t root;
+	int full;					/* the last parse ran out of segment */
+} builder_t;
+
+/* arena bytes a builder_parse() of json will need, header not included */
+int builder_measure(const char *json, size_t length, size_t *bytes, char *error);
+
+builder_t* builder_create(jss_header_t *header, hash_userset_t *userset);
+int builder_parse(builder_t *builder, const char *json, size_t length, jss_value_t *root, char *error);
+void builder_del(builder_t *builder);
+
+#endif
@@ -6,18 +6,11 @@
 *
 ***************************************************************************/
 
-/***************************************************************************
-* RCS INFORMATION:
-*
-*      $RCSfile: hash.c,v $
-*      $Author: johns $        $Locker:  $             $State: Exp $
-*      $Revision: 1.15 $      $Date: 2013/05/30 21:56:15 $
-*
-***************************************************************************
-* DESCRIPTION:
-*   A simple hash table implementation for strings, contributed by John Stone,
-*   derived from his ray tracer code.
-***************************************************************************/
+/*
+ * hash64(), the string hash of keys and interned strings, and the allocator
+ * hooks the builder is handed. Originally a string hash table contributed
+ * by John Stone; objects are perfect hashed now, see phash.h.
+ */
 
 /*
  *  ޸ Ҵ ϵ 
@@ -27,357 +20,97 @@
  * 2014.06 jseol
  */
 
-#include <malloc.h>
 #include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
-#include "error.h"
 #include "hash.h"
 
-#define HASH_LIMIT 1
-
-typedef struct hash_node_t {
-	int dataoffset;						/* data offset in hash node */
-	int keyoffset;						/* key offset for hash lookup */
-	int nextoffset;						/* next node offset from hash_t */
-} hash_node_t;
-
-static void * memalloc (int cnt, size_t size, void *userdata)
-{
-	return calloc(cnt, size);
-}
-
-static void memfree (void *ptr, void *userdata)
-{
-	free(ptr);
-}
-
 /*
-*  hash() - Hash function returns a hash number for a given key.
+*  hash64() - 64 bit string hash, after wyhash (Wang Yi, public domain).
+*  The seed is fixed: hashes are stored in shared segments and must agree
+*  between processes.
 *
-*  tptr: Pointer to a hash table
-*  key: The key to create a hash number for
+*  key: The bytes to hash
+*  length: Number of bytes
 */
-static int hash(const hash_t *tptr, const char *key) {
-	int i=0;
-	int hashvalue;
-
-	while (*key != '\0')
-		i=(i<<3)+(*key++ - '0');
-
-	hashvalue = (((i*1103515249)>>tptr->downshift) & tptr->mask);
-	if (hashvalue < 0) {
-		hashvalue = 0;
-	}    
-
-	return hashvalue;
+static const uint64_t hash_secret[4] = {
+	0xA0761D6478BD642FULL, 0xE7037ED1A0B428DBULL,
+	0x8EBC6AF09C88C6E3ULL, 0x589965CC75374CC3ULL
+};
+
+/* 64x64 -> 128 bit multiply, low half in a, high half in b */
+static inline void hash_mum(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+	__uint128_t r = (__uint128_t) *a * *b;
+	*a = (uint64_t) r;
+	*b = (uint64_t) (r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t) *a, lb = (uint32_t) *b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl, lo;
+
+	lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
 }
 
-/*
-*  hash_init() - Initialize a new hash table.
-*
-*  tptr: Pointer to the hash table to initialize
-*  buckets: The number of initial buckets to create
-*/
-static int hash_init(hash_t *tptr, int buckets) {
-	void *nodearray;
-
-	/* make sure we allocate something */
-	if (buckets==0)
-		buckets=16;
-
-	/* initialize the table */
-	tptr->entries=0;
-	tptr->size=2;
-	tptr->mask=1;
-	tptr->downshift=29;
-
-	/* ensure buckets is a power of 2 */
-	while (tptr->size<buckets) {
-		tptr->size<<=1;
-		tptr->mask=(tptr->mask<<1)+1;
-		tptr->downshift--;
-	} /* while */
-
-	/* allocate memory for table */
-	nodearray = tptr->us.memalloc(tptr->size, sizeof(int), tptr->us.userdata);
-	if (!nodearray) return false;
-	tptr->bucketoffset = (unsigned char *) tptr - (unsigned char *) nodearray;
-	errprint("[hash_init] nodearray(0x%x), offset(%d)", nodearray, tptr->bucketoffset);
-	return true;
-}	
-
-VMDEXTERNSTATIC hash_t* hash_create(int buckets, hash_userset_t *userset) {
-	hash_userset_t us, *usptr = userset;
-	hash_t *tptr;
-
-	if (!usptr) {
-		usptr = &us;
-		us.memalloc = memalloc;
-		us.memfree = memfree;
-		us.userdata = NULL;
-	}
-
-	tptr = (hash_t *) usptr->memalloc(1, sizeof(hash_t), usptr->userdata);
-	if (!tptr) return NULL;
-	memcpy(&tptr->us, usptr, sizeof(hash_userset_t));
-
-	if (!hash_init(tptr, buckets)) {
-		hash_destroy(tptr);
-		return NULL;
-	}
-	
-	errscope(
-		int *nodearray = (int *) ((unsigned char*) tptr - tptr->bucketoffset);
-		errprint("tptr(0x%x), bucketoffset(0x%x, %d), count(%d/%d)", tptr, nodearray, tptr->bucketoffset, buckets, tptr->size);
-		for(int i=0; i<tptr->size; i++) {
-			errprint("bucket(%d) is %d", i, nodearray[i]);
-		}
-	);
-
-	return tptr;
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+	hash_mum(&a, &b);
+	return a ^ b;
 }
 
-/*
-*  rebuild_table() - Create new hash table when old one fills up.
-*
-*  tptr: Pointer to a hash table
-*/
-static int rebuild_table(hash_t *tptr) {
-	hash_node_t *old_hash;
-	int old_size, h, i, *new_bucket, *old_bucket, offset;
-
-	old_bucket = (int *) ((unsigned char*) tptr - tptr->bucketoffset);
-	old_size=tptr->size;
-
-	/* create a new table and rehash old buckets */
-	if (!hash_init(tptr, old_size<<1))
-		return false;
-	new_bucket = (int *) ((unsigned char*) tptr - tptr->bucketoffset);
-	for (i=0; i<old_size; i++) {
-		for (offset = old_bucket[i]; offset != 0; ) {
-			old_hash=(hash_node_t *) ((unsigned char*) tptr - offset);
-			offset = old_hash->nextoffset;
-
-			h=hash(tptr, (char *)((unsigned char *) tptr - old_hash->keyoffset));
-			old_hash->nextoffset=new_bucket[h];
-			new_bucket[h]=((unsigned char*) tptr - (unsigned char *) old_hash);
-			tptr->entries++;
-		}
-	} /* for */
-
-	/* free memory used by old table */
-	tptr->us.memfree(old_bucket, tptr->us.userdata);
-
-	return true;
+static inline uint64_t hash_read8(const unsigned char *p) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
 }
 
-/*
-*  hash_lookup() - Lookup an entry in the hash table and return a pointer to
-*    it or HASH_FAIL if it wasn't found.
-*
-*  tptr: Pointer to the hash table
-*  key: The key to lookup
-*/
-VMDEXTERNSTATIC void* hash_lookup(const hash_t *tptr, const char *key) {
-	int h, *bucket, offset;
-	hash_node_t *node = NULL;
-
-	bucket = (int *) ((unsigned char*) tptr - tptr->bucketoffset);
-
-	errscope(
-		errprint("tptr(0x%x), tptr->bucketoffset(%d)", tptr, tptr->bucketoffset);
-		for(int i=0; i<tptr->size; i++) {
-			errprint("bucket(%d) is %d", i, bucket[i]);
-		}
-	);
-
-	/* find the entry in the hash table */
-	h=hash(tptr, key);
-	for (offset = bucket[h]; offset != 0; offset = node->nextoffset) {
-		node=(hash_node_t *)((unsigned char *) tptr - offset);
-		errprint("tptr(0x%x), bucket(%d,%d), offset(%d), node(0x%x), key(%s)", tptr, h, bucket[h], offset,node,key);
-		if (!strcmp((char *)((unsigned char *) tptr - node->keyoffset), key)) {
-			break;
-		}
-	}
-
-	/* return the entry if it exists, or HASH_FAIL */
-	return(offset ? (void*)((unsigned char *) tptr - node->dataoffset) : HASH_FAIL);
+static inline uint64_t hash_read4(const unsigned char *p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
 }
 
-VMDEXTERNSTATIC void hash_enumerator(const hash_t *tptr, hash_enum_callback_t callee, void *userdata1, void *userdata2) {
-	hash_node_t *node;
-	int i, c=0, *bucket, offset;
-	char *key;
-	void *data;
-
-	bucket = (int *) ((unsigned char*) tptr - tptr->bucketoffset);
-
-	if (tptr->bucketoffset) {
-		for (i=0; i<tptr->size; i++) {
-			for (offset = bucket[i]; offset != 0; offset = node->nextoffset) {
-				node = (hash_node_t *)((unsigned char *) tptr - offset);
-				key = (char *)((unsigned char *) tptr - node->keyoffset);
-				data = (void *)((unsigned char *) tptr - node->dataoffset);
-				callee(tptr, c++, key, data, userdata1, userdata2);
-			}
-		} 
-	}
-}
-
-/*
-*  hash_insert() - Insert an entry into the hash table.  If the entry already
-*  exists return a pointer to it, otherwise return HASH_FAIL.
-*
-*  tptr: A pointer to the hash table
-*  key: The key to insert into the hash table
-*  data: A pointer to the data to insert into the hash table
-*/
-VMDEXTERNSTATIC void* hash_insert(hash_t *tptr, const char *key, void *data) {
-	void *tmp;
-	hash_node_t *node;
-	int h, *bucket;
-
-	bucket = (int *) ((unsigned char*) tptr - tptr->bucketoffset);
-
-	/* check to see if the entry exists */
-	if ((tmp=hash_lookup(tptr, key)) != HASH_FAIL)
-		return(tmp);
-	/* expand the table if needed */
-	while (tptr->entries>=HASH_LIMIT*tptr->size) {
-		if (!rebuild_table(tptr))
-			return HASH_FAIL;
-	}
-
-	bucket = (int *) ((unsigned char*) tptr - tptr->bucketoffset);
-
-	/* insert the new entry */
-	h=hash(tptr, key);
-	node=(struct hash_node_t *) tptr->us.memalloc(1, sizeof(hash_node_t), tptr->us.userdata);
-	if (!node) return HASH_FAIL;
-	node->dataoffset=(unsigned char *) tptr - (unsigned char *) data;
-	node->keyoffset=(unsigned char *) tptr - (unsigned char *) key;
-	node->nextoffset=bucket[h];
-	bucket[h]= (unsigned char *) tptr - (unsigned char *) node;
-	tptr->entries++;
-	errprint("tptr(0x%x), key(%s), bucket(%d, %d), node(0x%x), node.nextoffset(%d)", tptr, key, h, bucket[h], node, node->nextoffset);
-
-	return node;
-}
-
-/*
-*  hash_remove() - Remove an entry from a hash table and return a pointer
-*  to its data or HASH_FAIL if it wasn't found.
-*
-*  tptr: A pointer to the hash table
-*  key: The key to remove from the hash table
-*/
-VMDEXTERNSTATIC void* hash_remove(hash_t *tptr, const char *key) {
-	hash_node_t *node = NULL, *last = NULL;
-	void *data;
-	int h, *bucket, offset;
-
-	bucket = (int *) ((unsigned char*) tptr - tptr->bucketoffset);
-
-	/* find the node to remove */
-	h=hash(tptr, key);
-	for (offset = bucket[h]; offset != 0; offset = node->nextoffset) {
-		node=(hash_node_t *)((unsigned char *) tptr - offset);
-		if (strcmp((char *)((unsigned char *) tptr - node->keyoffset), key)) {
-			last = node;
-			continue;
-		}
-
-		if (offset == bucket[h]) {
-		/* if node is at head of bucket, we have it easy */
-			bucket[h]=node->nextoffset;
+uint64_t hash64(const void *key, size_t length) {
+	const unsigned char *p = (const unsigned char *) key;
+	uint64_t seed = hash_mix(hash_secret[0], hash_secret[1]);
+	uint64_t a, b, see1, see2;
+	size_t i = length;
+
+	if (length <= 16) {
+		if (length >= 4) {
+			a = (hash_read4(p) << 32) | hash_read4(p + ((length >> 3) << 2));
+			b = (hash_read4(p + length - 4) << 32) | hash_read4(p + length - 4 - ((length >> 3) << 2));
+		} else if (length > 0) {
+			a = ((uint64_t) p[0] << 16) | ((uint64_t) p[length >> 1] << 8) | p[length - 1];
+			b = 0;
 		} else {
-		/* find the node before the node we want to remove */
-			last->nextoffset = node->nextoffset;
+			a = b = 0;
 		}
-		break;
-	}
-
-	/* Didn't find anything, return HASH_FAIL */
-	if (offset == 0)
-		return HASH_FAIL;
-
-	/* free memory and return the data */
-	data=(void*)((unsigned char *) tptr - node->dataoffset);
-	tptr->us.memfree(node, tptr->us.userdata);
-	tptr->entries--;
-
-	return data;
-}
-
-
-/*
-* inthash_entries() - return the number of hash table entries.
-*
-*/
-VMDEXTERNSTATIC int hash_entries(hash_t *tptr) {
-	return tptr->entries;
-}
-
-
-/*
-* hash_destroy() - Delete the entire table, and all remaining entries.
-* 
-*/
-VMDEXTERNSTATIC void hash_destroy(hash_t *tptr) {
-	hash_node_t *node;
-	int i, *bucket, offset;
-
-	bucket = (int *) ((unsigned char*) tptr - tptr->bucketoffset);
-	
-	if (tptr->bucketoffset) {
-		for (i=0; i<tptr->size; i++) {
-			for (offset = bucket[i]; offset != 0; offset = node->nextoffset) {
-				node=(hash_node_t *)((unsigned char *) tptr - offset);
-				tptr->us.memfree(node, tptr->us.userdata);
-			}
-		}   
-
-		/* free the entire array of buckets */
-		tptr->us.memfree(bucket, tptr->us.userdata);
+	} else {
+		if (i > 48) {
+			see1 = see2 = seed;
+			do {
+				seed = hash_mix(hash_read8(p) ^ hash_secret[1], hash_read8(p + 8) ^ seed);
+				see1 = hash_mix(hash_read8(p + 16) ^ hash_secret[2], hash_read8(p + 24) ^ see1);
+				see2 = hash_mix(hash_read8(p + 32) ^ hash_secret[3], hash_read8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = hash_mix(hash_read8(p) ^ hash_secret[1], hash_read8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = hash_read8(p + i - 16);
+		b = hash_read8(p + i - 8);
 	}
 
-	tptr->us.memfree(tptr, tptr->us.userdata);
-}
-
-/*
-*  alos() - Find the average length of search.
-*
-*  tptr: Pointer to a hash table
-*/
-static float alos(hash_t *tptr) {
-	int i,j, *bucket, offset;
-	float alos=0;
-	hash_node_t *node;
-
-	bucket = (int *) ((unsigned char*) tptr - tptr->bucketoffset);
-
-	for (i=0; i<tptr->size; i++) {
-		for (offset = bucket[i], j=0; offset != 0; offset = node->nextoffset, j++);
-		if (j)
-			alos+=((j*(j+1))>>1);
-	} /* for */
-
-	return(tptr->entries ? alos/tptr->entries : 0);
+	a ^= hash_secret[1];
+	b ^= seed;
+	hash_mum(&a, &b);
+	return hash_mix(a ^ hash_secret[0] ^ length, b ^ hash_secret[1]);
 }
-
-/*
-*  hash_stats() - Return a string with stats about a hash table.
-*
-*  tptr: A pointer to the hash table
-*/
-VMDEXTERNSTATIC char * hash_stats(hash_t *tptr) {
-	static char buf[1024];
-
-	sprintf(buf, "%u slots, %u entries, and %1.2f ALOS",
-		(int)tptr->size, (int)tptr->entries, alos(tptr));
-
-	return(buf);
-}
\ No newline at end of file
@@ -6,24 +6,19 @@
 *
 ***************************************************************************/
 
-/***************************************************************************
-* RCS INFORMATION:
-*
-*      $RCSfile: hash.h,v $
-*      $Author: johns $        $Locker:  $             $State: Exp $
-*      $Revision: 1.15 $      $Date: 2013/09/09 01:42:35 $
-*
-***************************************************************************
-* DESCRIPTION:
-*   A simple hash table implementation for strings, contributed by John Stone,
-*   derived from his ray tracer code.
-***************************************************************************/
+/*
+ * hash64(), the string hash of keys and interned strings, and the allocator
+ * hooks the builder is handed. Originally a string hash table contributed
+ * by John Stone; objects are perfect hashed now, see phash.h.
+ */
 #ifndef HASH_H
 #define HASH_H
 
+#include <stddef.h>
+#include <stdint.h>
 
 typedef struct hash_userset_t {
-   /* Custom allocator support (leave null to use malloc/free) */
+   /* the allocator the builder takes records from */
    void * (*memalloc) (int cnt, size_t size, void *userdata);
    void (*memfree) (void *, void *userdata);
 
@@ -31,51 +26,14 @@ typedef struct hash_userset_t {
 
 } hash_userset_t;
 
-typedef struct hash_t {
-	int bucketoffset; //struct hash_node_t **bucket;      /* array of hash nodes */
-	int size;                         /* size of the array */
-	int entries;                      /* number of entries in table */
-	int downshift;                    /* shift count, used in hash function */
-	int mask;                         /* used to select bits for hashing */
-
-	hash_userset_t us;
-} hash_t;
-
-typedef void (*hash_enum_callback_t)(const hash_t *tptr, int idx, char *key, void *data, void *userdata1, void* userdata2);
-
-#define HASH_FAIL (void*)-1
-
-#if defined(VMDPLUGIN_STATIC)
-#define VMDEXTERNSTATIC static
-#include "hash.c"
-#else
-
-#define VMDEXTERNSTATIC 
-
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-	hash_t* hash_create(int buckets, hash_userset_t *userset);
-
-	void* hash_lookup (const hash_t *, const char *);
-
-	void hash_enumerator(const hash_t *, hash_enum_callback_t, void *userdata1, void *userdata2 = NULL);
-
-	void* hash_insert (hash_t *, const char *, void *);
-
-	void* hash_remove (hash_t *, const char *);
-
-	int hash_entries(hash_t *);
-
-	void hash_destroy(hash_t *);
-
-	char *hash_stats (hash_t *);
+uint64_t hash64(const void *key, size_t length);
 
 #ifdef __cplusplus
 }
 #endif
 
 #endif
-
-#endif
\ No newline at end of file
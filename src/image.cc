@@ -0,0 +1,180 @@
+#if defined (_WIN32) || defined (_WIN64)
+#include <windows.h>
+#include <io.h>
+
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "image.h"
+
+/* a mapped file is only trusted as far as its header says */
+static int check(const jss_header_t *header, size_t size)
+{
+	if (size < sizeof(jss_header_t) || header->magic != JSS_MAGIC) {
+		printf("[image] not a jss image\n");
+		return 0;
+	}
+	if (header->version != JSS_VERSION) {
+		printf("[image] version %u, expected %u\n", header->version, JSS_VERSION);
+		return 0;
+	}
+	if (header->used < sizeof(jss_header_t) || header->used > size) {
+		printf("[image] truncated, %llu of %llu bytes\n",
+			(unsigned long long) size, (unsigned long long) header->used);
+		return 0;
+	}
+	return 1;
+}
+
+int image_save(const jss_header_t *header, const char *path)
+{
+	char tmp[1024];
+	FILE *fp = NULL;
+
+	if (!header || !path || !check(header, (size_t) header->used))
+		return 0;
+
+	for (;;) {
+		if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int) sizeof(tmp))
+			break;
+
+		fp = fopen(tmp, "wb");
+		if (!fp) {
+			printf("[image] can't create %s\n", tmp);
+			break;
+		}
+		if (fwrite(header, 1, (size_t) header->used, fp) != header->used) {
+			printf("[image] write error %s\n", tmp);
+			break;
+		}
+		if (fflush(fp) != 0)
+			break;
+#if !defined (_WIN32) && !defined (_WIN64)
+		fsync(fileno(fp));
+#endif
+		fclose(fp);
+		fp = NULL;
+
+#if defined (_WIN32) || defined (_WIN64)
+		if (!MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING))
+			break;
+#else
+		if (rename(tmp, path) < 0) {
+			printf("[image] rename to %s error %d\n", path, errno);
+			break;
+		}
+#endif
+		errprint("saved %s, %llu bytes", path, (unsigned long long) header->used);
+		return 1;
+	}
+
+	if (fp) fclose(fp);
+	remove(tmp);
+
+	return 0;
+}
+
+image_t* image_open(const char *path)
+{
+	image_t *image = NULL;
+
+	if (!path) return NULL;
+
+#if defined (_WIN32) || defined (_WIN64)
+	LARGE_INTEGER size;
+
+	for (;;) {
+		image = (image_t*) calloc(1, sizeof(image_t));
+		if (!image) break;
+
+		image->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (image->file == INVALID_HANDLE_VALUE) {
+			image->file = NULL;
+			printf("[image] can't open %s (%d)\n", path, GetLastError());
+			break;
+		}
+		if (!GetFileSizeEx(image->file, &size))
+			break;
+
+		image->mapping = CreateFileMapping(image->file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!image->mapping) break;
+
+		image->at = MapViewOfFile(image->mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!image->at) break;
+		image->size = (size_t) size.QuadPart;
+
+		if (!check((jss_header_t *) image->at, image->size))
+			break;
+
+		return image;
+	}
+
+#else
+	struct stat st;
+
+	for (;;) {
+		image = (image_t*) calloc(1, sizeof(image_t));
+		if (!image) break;
+		image->fd = -1;
+
+		image->fd = open(path, O_RDONLY);
+		if (image->fd < 0) {
+			printf("[image] can't open %s (%d)\n", path, errno);
+			break;
+		}
+		if (fstat(image->fd, &st) < 0 || st.st_size < (off_t) sizeof(jss_header_t)) {
+			printf("[image] %s is too small\n", path);
+			break;
+		}
+
+		image->at = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, image->fd, 0);
+		if (image->at == MAP_FAILED) {
+			image->at = NULL;
+			printf("[image] mmap %s error %d\n", path, errno);
+			break;
+		}
+		image->size = st.st_size;
+
+		if (!check((jss_header_t *) image->at, image->size))
+			break;
+
+		return image;
+	}
+#endif
+
+	image_close(image);
+
+	return NULL;
+}
+
+jss_header_t* image_header(image_t *image)
+{
+	if (!image) return NULL;
+	return (jss_header_t *) image->at;
+}
+
+void image_close(image_t *image)
+{
+	if (!image) return;
+
+#if defined (_WIN32) || defined (_WIN64)
+	if (image->at) UnmapViewOfFile(image->at);
+	if (image->mapping) CloseHandle(image->mapping);
+	if (image->file) CloseHandle(image->file);
+#else
+	if (image->at) munmap(image->at, image->size);
+	if (image->fd >= 0) close(image->fd);
+#endif
+
+	free(image);
+}
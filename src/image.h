@@ -0,0 +1,40 @@
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include <stddef.h>
+#include "jssdata.h"
+
+/**
+ A segment saved to a file, to be mapped back read-only without parsing.
+
+ if (!image_save(header, "items.jss"))
+     printf("%s\n", error);
+
+ image_t *image = image_open("items.jss");
+ jss_header_t *header = image_header(image);
+ image_close(image);
+
+ Only header->used bytes are written. The segment is position independent,
+ so the mapping works wherever it lands, and every process mapping the
+ same file shares its page cache pages.
+ */
+
+typedef struct image_t {
+	void *at;
+	size_t size;
+
+#if defined (_WIN32) || defined (_WIN64)
+	void *file;
+	void *mapping;
+#else
+	int fd;
+#endif
+} image_t;
+
+/* writes path.tmp and renames it over path, so readers never see half a file */
+int image_save(const jss_header_t *header, const char *path);
+image_t* image_open(const char *path);
+jss_header_t* image_header(image_t *image);
+void image_close(image_t *image);
+
+#endif
@@ -2,112 +2,156 @@
 #include <node.h>
 #include "hash.h"
 #include "json.h"
+#include "jssdata.h"
+#include "builder.h"
 #include "semaphore.h"
-#include "mempool.h"
+#include "arena.h"
 #include "crc32.h"
 #include "shm.h"
+#include "image.h"
+#include "registry.h"
+#include "once.h"
+#include "wrapcache.h"
+#include "path.h"
 #include "error.h"
 
 using namespace v8;
 
 /* */
 
-void* memalloc (int cnt, size_t size, void *mp)
+void* arenaalloc (int cnt, size_t size, void *arena)
 {
-	int allocsize = cnt*size;
+	size_t allocsize = cnt*size;
 	void *p;
 
-	p = mempool_alloc((mp_t*)mp, allocsize);
+	p = arena_alloc((arena_t*)arena, allocsize, ARENA_ALIGN_8);
 	if (p) memset(p, 0, allocsize);
 
 	return p;
 }
 
-void memfree(void *p, void *mp)
+/* the dataset is immutable once built, so nothing is ever given back */
+void arenafree(void *p, void *arena)
 {
-	if (p) {
-		mempool_free((mp_t*)mp, p);
-	}
 }
 
-char* strndup(char *src, void *mp)
-{
-	char *s = NULL;
-	int len;
+#define JSS_SHM_SYSV		0		/* shmget, sized by kernel.shmmax */
+#define JSS_SHM_POSIX		1		/* shm_open + mmap, named /jss.<crc32> */
 
-	len = strlen(src) + 1;
-	s = (char*) memalloc(1, len, mp);
-	if (s) {
-		strncpy(s, src, len);
-	}
-	return s;
-}
+#define JSS_REGISTRY		"/jss.registry"		/* named datasets, see registry.h */
 
-char* itoindex(unsigned int i, void *mp)
-{
-	const char *format = "IDX_%d";
-	int len = 5;
-	int l = i;
-	char *s = NULL;
+#define JSS_WARM_CHUNK		((shm_size_t) 4 << 20)	/* progress is reported per chunk */
 
-	for (; l; len++) {
-		l /= 10;
-	}
-	
-	s = (char*) memalloc(1, len, mp);
-	if (s) {
-		sprintf(s, format, i);
-	}
-
-	return s;
-}
-
-/* */
-typedef struct jss_header_t {
-	unsigned int magic;
+#define JSS_WARM_RUNNING	0
+#define JSS_WARM_DONE		1
+#define JSS_WARM_UNLOCKED	2		/* faulted in, but mlock failed */
 
-	unsigned int name;
+/* faulting a root's dataset in, see Jss::Warm() */
+typedef struct warm_t {
+	uv_thread_t thread;
+	const unsigned char *at;
+	shm_size_t size;
+	int opt;						/* SHM_MLOCK or 0 */
+	int background;
+	volatile shm_size_t done;
+	volatile int stop;
+	volatile int state;
+} warm_t;
 
-	unsigned int lastParsed;
-	long start;
-
-	unsigned char data[];
-} jss_header_t;
-
-typedef struct jss_data_t {
-	json_type type;
-	union {
-		json_int_t integer;
-		double dbl;
-		int boolean;
-
-		struct {
-			int length;
-			int offset;
-		} string;
+static void warm_run(void *arg)
+{
+	warm_t *warm = (warm_t *) arg;
+	shm_size_t offset, n;
+	int locked = 1;
+
+	for (offset = 0; offset < warm->size && !warm->stop; offset += n) {
+		n = std::min(JSS_WARM_CHUNK, warm->size - offset);
+		locked &= shm_prefault(warm->at + offset, n, warm->opt);
+		warm->done = offset + n;
+	}
+	warm->state = locked ? JSS_WARM_DONE : JSS_WARM_UNLOCKED;
+}
 
-		int objectoffset;
-	} u;
-} jss_data_t;
+class Jss;
+
+/*
+ * A view of an object or array below the root is a plain V8 object with
+ * two aligned internal fields, the dataset it belongs to and the offset of
+ * its record, and no C++ object of its own. Records are 8 byte aligned,
+ * which leaves a low bit of the offset to tell arrays apart.
+ */
+#define JSS_VIEW_FIELDS		2
+#define JSS_VIEW_ARRAY		2
+
+/* long strings are read in place, shorter ones are cheaper to copy */
+#define JSS_EXTERNAL_MIN	JSS_STRING_WIDE_MIN
+
+/*
+ * What the views and external strings of one version of a root's dataset
+ * share. Only the root owns the segment: while any of them live, the view
+ * prototypes hold the root, so the segment outlives them. Once the last
+ * one is collected the prototypes are dropped after that GC, and a root
+ * that moved on to another version frees the rest, see Jss::DropIdle().
+ */
+typedef struct jss_dataset_t {
+	jss_header_t *header;
+	Jss *root;						/* NULL once the root moved on or died */
+	int version;					/* registry version held for the users, 0 for none */
+	int users;						/* live views and external strings */
+	int idle;						/* on the idle list, users dropped to 0 */
+	struct jss_dataset_t *next;		/* on the idle list */
+	wrapcache_t *cache;				/* offset -> the weak handle of its live view */
+	Persistent<Object> protos[2];	/* for objects and arrays, while used */
+} jss_dataset_t;
 
 /* */
 class Jss : public node::ObjectWrap {
 public:
-	int AllocStorage(unsigned int key, unsigned int size);
+	int LoadStorage(unsigned int key, const char *json, int len, int backend, int shmopt, char *error);
+	int AttachStorage(unsigned int key, int backend);
+	int AttachReadOnly(unsigned int key, int backend);
+	int AllocStorage(unsigned int key, shm_size_t size, int backend, int shmopt);
+	int InitStorage();
+	void ShrinkStorage();
 	void FreeStorage();
+	void TrackStorage();
+	void UntrackStorage();
+	int Warm(int opt, int background);
+	void StopWarm();
+	int AttachRegistered(const char *name);
+	int AttachVersion(registry_entry_t *entry);
+	void Refresh();
+	int BuildInto(jss_header_t *header, size_t size, const char *json, int len, int *full, char *error);
+	int BuildRegistered(const char *name, unsigned int crc, const char *json, int len, char *error);
 	int EnterLock();
 	int LeaveLock();
-	jss_data_t* Parse(json_value *jval);
-	void* OffsetToPtr(long offset);
-	long PtrToOffset(void *ptr);
-	void SetData(jss_data_t *jdata);
+	void* OffsetToPtr(int64_t offset);
+	int64_t PtrToOffset(void *ptr);
+	void SetData(jss_value_t value);
 	void SetLastParsed(unsigned int crc);
 	unsigned int GetLastParsed();
-	Handle<Value> ShallowClone(jss_data_t *jdata);
-	
+	jss_dataset_t* Dataset();
+	void ReleaseDataset();
+
+	static void Use(jss_dataset_t *dataset);
+	static void Unuse(jss_dataset_t *dataset);
+	static void DropIdle(GCType type, GCCallbackFlags flags);
+	static void FreeDataset(jss_dataset_t *dataset);
+	static Handle<Value> View(jss_dataset_t *dataset, jss_value_t value);
+	static void ViewWeak(Persistent<Value> object, void *param);
+	static Handle<String> ExternalString(jss_dataset_t *dataset, const jss_string_t *str);
+	static jss_dataset_t* Resolve(Handle<Object> holder, jss_value_t *value);
+	static Handle<Value> ToValue(jss_dataset_t *dataset, const jss_value_t *cell);
+	static jss_array_t* GetArray(jss_dataset_t *dataset, jss_value_t value);
+	static jss_object_t* GetObject(jss_dataset_t *dataset, jss_value_t value);
+	static Handle<Array> GetKeys(jss_dataset_t *dataset, jss_value_t value);
+
 
 	static void Init(Handle<Object> target);
 	static Handle<Value> NewInstance(int argc, Handle<Value> argv[]);
+	static int IsRoot(Handle<Value> value);
+	static int IsView(Handle<Value> value);
+	static registry_t* Registry();
 
 //private:
 	 Jss();
@@ -119,42 +163,91 @@ public:
 	static Handle<Array> EnumerateNamedProperty(const AccessorInfo &info);
 	static Handle<Value> GetIndexedProperty(uint32_t index, const AccessorInfo &info);
 	static Handle<Array> EnumerateIndexedProperty(const AccessorInfo& info);
+	static Persistent<FunctionTemplate> root_template_;
 	static Persistent<Function> constructor_template_;
+	static Persistent<FunctionTemplate> view_template_;
+	static Persistent<Function> view_constructor_;
+	static Persistent<Value> array_prototype_;
+	static registry_t *registry_;
+	static jss_dataset_t *idle_;
 
 	jss_header_t *header_;
 	sema_t sema_;
 	shm_t *shm_;
-	mp_t *mp_;
-	jss_data_t *data_;
-	int isCloned_;
+	image_t *image_;
+	arena_t *arena_;
+	jss_value_t data_;
 	hash_userset_t userset_;
 
-	unsigned int size_;
+	shm_size_t size_;
 	unsigned int key_;
+
+	int version_;					/* registry version held, 0 for none */
+	registry_entry_t *entry_;		/* set on roots that follow their name */
+	int tracked_;					/* shm_ is recorded in the registry */
+	warm_t *warm_;					/* see Warm() */
+	jss_dataset_t *dataset_;		/* made on the first access below the root */
 };
 
+Persistent<FunctionTemplate> Jss::root_template_;
 Persistent<Function> Jss::constructor_template_;
+Persistent<FunctionTemplate> Jss::view_template_;
+Persistent<Function> Jss::view_constructor_;
+Persistent<Value> Jss::array_prototype_;
+registry_t *Jss::registry_ = NULL;
+jss_dataset_t *Jss::idle_ = NULL;
 
 Jss::Jss() 
 {
 	header_ = NULL;
 	sema_ = NULL;
 	shm_ = NULL;
-	mp_ = NULL;
-	data_ = NULL;
-	isCloned_ = false;
+	image_ = NULL;
+	arena_ = NULL;
+	data_ = JSS_NONE;
 
 	size_ = 0;
 	key_ = 0;
 
-	userset_.memalloc = memalloc;
-	userset_.memfree = memfree;
+	version_ = 0;
+	entry_ = NULL;
+	tracked_ = 0;
+	warm_ = NULL;
+	dataset_ = NULL;
+
+	userset_.memalloc = arenaalloc;
+	userset_.memfree = arenafree;
+	userset_.userdata = NULL;
 }
 
 Jss::~Jss() 
 {
-	if (!isCloned_)
-		FreeStorage();
+	/* views would still hold the root, so there are none left */
+	ReleaseDataset();
+	StopWarm();
+	UntrackStorage();
+	FreeStorage();
+	if (version_)
+		registry_release(registry_, version_);
+}
+
+/*
+ * After a build, gives the segment memory past header->used back. Named
+ * segments shrink in place; SysV ones keep the size they were measured
+ * at, whoever attached while it was built may still map all of it.
+ */
+void Jss::ShrinkStorage()
+{
+	if (shm_ && shm_shrink(shm_, header_->used)) {
+		header_ = (jss_header_t*) shm_get(shm_);
+		size_ = shm_->size;
+	}
+
+	/* the arena may point into the old mapping, and it is done anyway */
+	if (arena_) {
+		arena_del(arena_);
+		arena_ = NULL;
+	}
 }
 
 void Jss::FreeStorage()
@@ -162,55 +255,459 @@ void Jss::FreeStorage()
 	//printf(" ================ FREE ===============\n");
 	if (sema_) sema_del(sema_);
 	if (shm_) shm_del(shm_);
-	if (mp_) mempool_del(mp_);
+	if (image_) image_close(image_);
+	if (arena_) arena_del(arena_);
+
+	sema_ = NULL;
+	shm_ = NULL;
+	image_ = NULL;
+	arena_ = NULL;
+	header_ = NULL;
+}
+
+/*
+ * Records the segment in the registry, so jss.list() and jssadm see it
+ * and a crash doesn't leave it behind unnoticed. Best effort: without the
+ * registry the segment works all the same.
+ */
+void Jss::TrackStorage()
+{
+	registry_t *registry = Registry();
+
+	if (!shm_ || !registry)
+		return;
+	registry_lock(registry);
+	tracked_ = registry_attach_segment(registry, shm_->fd >= 0 ? shm_->name : "", shm_->key, shm_->size);
+	registry_unlock(registry);
 }
 
-int Jss::AllocStorage(unsigned int key, unsigned int size)
+void Jss::UntrackStorage()
 {
+	if (!tracked_ || !shm_)
+		return;
+	registry_lock(registry_);
+	registry_detach_segment(registry_, shm_->fd >= 0 ? shm_->name : "", shm_->key);
+	registry_unlock(registry_);
+	tracked_ = 0;
+}
+
+/*
+ * Faults the whole dataset in, header_ up to header->used, so requests
+ * don't take the page faults; with SHM_MLOCK it is kept resident too.
+ * In the background this returns at once and warm_ tells how far it got,
+ * see warmup(). Works the same for segments, registry versions and images.
+ */
+int Jss::Warm(int opt, int background)
+{
+	StopWarm();
+	if (!header_)
+		return 0;
+
+	warm_ = (warm_t *) calloc(1, sizeof(warm_t));
+	if (!warm_)
+		return 0;
+	warm_->at = (const unsigned char *) header_;
+	warm_->size = header_->used;
+	warm_->opt = opt;
+	warm_->background = background;
+
+	if (!background || uv_thread_create(&warm_->thread, warm_run, warm_) != 0) {
+		warm_->background = 0;
+		warm_run(warm_);
+	}
+	return 1;
+}
+
+/* must come before the dataset is unmapped or released */
+void Jss::StopWarm()
+{
+	if (!warm_)
+		return;
+	warm_->stop = 1;
+	if (warm_->background)
+		uv_thread_join(&warm_->thread);
+	/* a registry region stays mapped after us */
+	if (warm_->opt & SHM_MLOCK)
+		shm_unlock(warm_->at, warm_->done);
+	free(warm_);
+	warm_ = NULL;
+}
+
+/*
+ * Maps the segment of key, building it from json unless it is already
+ * built. Concurrent callers, in this or any other process, wait for the
+ * first one to finish instead of building it again; see once.h.
+ */
+int Jss::LoadStorage(unsigned int key, const char *json, int len, int backend, int shmopt, char *error)
+{
+	jss_value_t root = JSS_NONE;
+	builder_t *builder = NULL;
+	size_t size;
+	int built = 0;
+
+	/* the common case: someone built it, we only read */
+	if (AttachReadOnly(key, backend)) {
+		printf("[jss] crc32(0x%x) is already loaded.\n", key);
+		return 1;
+	}
+
+	if (!AttachStorage(key, backend)) {
+		if (!builder_measure(json, len, &size, error))
+			return 0;
+
+		if (!AllocStorage(key, size, backend, shmopt)) {
+			sprintf(error, "Can't create the segment");
+			return 0;
+		}
+	}
+
+	if (!once_begin(&header_->state)) {
+		if (header_->lastParsed != key) {
+			sprintf(error, "Segment holds 0x%x", header_->lastParsed);
+			return 0;
+		}
+		printf("[jss] crc32(0x%x) has been built by another process.\n", key);
+		data_ = header_->root;
+		AttachReadOnly(key, backend);
+		return 1;
+	}
+
+	/* ours to build, from scratch even if a builder died halfway */
 	for (;;) {
-		unsigned int realsize = sizeof(jss_header_t) + size;
-		jss_header_t *header;
-		int chunksize = 32;
-		int poolsize = size / (chunksize+sizeof(mp_hdr_t));
-
-		printf("chunksize(%d), size(%d), realsize(%d), poolsize(%d)\n", chunksize, size, realsize, poolsize);
-				
-		shm_ = shm_create(key, realsize, SHM_READWRITE);
-		if (!shm_) {
-			printf("shm_create error\n");
+		if (!InitStorage()) {
+			sprintf(error, "Can't initialize the segment");
 			break;
 		}
-		
-		header_ = header = (jss_header_t*) shm_get(shm_);
-		printf("header(0x%x), data(0x%x), size(%d), key(0x%x)\n", header, header->data, size, key);
-
-		if (header->magic =='_JSS') {
-			data_ = (jss_data_t *) OffsetToPtr(header->start);
-			printf("DATA_ = 0x%x\n", data_);
-			printf("AllocStorage header->start=%d\n", header->start);
-			
-		} else {
-			memset(header, 0, sizeof(jss_header_t));
-			header->magic = '_JSS';
+		builder = builder_create(header_, &userset_);
+		if (!builder) {
+			sprintf(error, "Out of memory");
+			break;
+		}
+		if (!builder_parse(builder, json, len, &root, error)) {
+			if (!builder->full)
+				break;
 
-			mp_ = mempool_create(header->data, chunksize, poolsize);
-			if (!mp_) {
-				printf("mempool_create error\n");
+			/* the estimate has headroom, doubling is only a fallback */
+			builder_del(builder);
+			builder = NULL;
+			arena_del(arena_);
+			arena_ = NULL;
+			if (!shm_grow(shm_, size_ * 2)) {
+				sprintf(error, "Can't grow the segment");
 				break;
 			}
-			printf("mempool_create() ok.\n");
+			header_ = (jss_header_t*) shm_get(shm_);
+			size_ = shm_->size;
+			continue;
+		}
+
+		if (arena_)
+			header_->used = sizeof(jss_header_t) + arena_->used;
+		SetData(root);
+		SetLastParsed(key);
+		built = 1;
+		break;
+	}
+	builder_del(builder);
+
+	once_end(&header_->state, built);
+	if (built) {
+		ShrinkStorage();
+		/* nobody writes it from now on, this process included */
+		AttachReadOnly(key, backend);
+	}
+	return built;
+}
+
+/*
+ * Maps the segment of key read-only, if it is ready. A writable mapping
+ * held so far is dropped; it is simply kept if this fails.
+ */
+int Jss::AttachReadOnly(unsigned int key, int backend)
+{
+	jss_header_t *header;
+	char name[SHM_NAME_MAX];
+	shm_t *shm;
+
+	if (backend == JSS_SHM_POSIX) {
+		sprintf(name, "/jss.%08x", key);
+		shm = shm_create_named(name, 0, SHM_READONLY|SHM_TRANSIENT);
+	} else {
+		shm = shm_create(key, 0, SHM_READONLY);
+	}
+	if (!shm) return 0;
+
+	header = (jss_header_t*) shm_get(shm);
+	if (shm->size < (shm_size_t) sizeof(jss_header_t) || header->magic != JSS_MAGIC ||
+		header->version != JSS_VERSION || !once_ready(&header->state) ||
+		header->lastParsed != key || (shm_size_t) header->used > shm->size) {
+		/* not ours to remove, it may be about to be built */
+		shm_close(shm);
+		return 0;
+	}
 
-			userset_.userdata = mp_;
+	/* attached before the writable one goes, so a SysV segment is never
+	   left without attachments and removed */
+	if (shm_) shm_del(shm_);
+	shm_ = shm;
+	header_ = header;
+	data_ = header->root;
+	size_ = shm->size;
+	key_ = key;
+	return 1;
+}
+
+/* maps the segment of key if it exists, whatever state it is in */
+int Jss::AttachStorage(unsigned int key, int backend)
+{
+	jss_header_t *header;
+	char name[SHM_NAME_MAX];
+
+	if (backend == JSS_SHM_POSIX) {
+		sprintf(name, "/jss.%08x", key);
+		shm_ = shm_create_named(name, 0, SHM_READWRITE|SHM_TRANSIENT);
+	} else {
+		shm_ = shm_create(key, 0, SHM_READWRITE);
+	}
+	if (!shm_) return 0;
+
+	/* all zeros is a segment another process has just created; a header
+	   of some other layout is moved out of the way, to be created anew */
+	header = (jss_header_t*) shm_get(shm_);
+	if (shm_->size < (shm_size_t) sizeof(jss_header_t) ||
+		(header->magic && (header->magic != JSS_MAGIC || header->version != JSS_VERSION))) {
+		shm_remove(shm_);
+		shm_del(shm_);
+		shm_ = NULL;
+		return 0;
+	}
+
+	header_ = header;
+	size_ = shm_->size;
+	key_ = key;
+	return 1;
+}
+
+/* mapped on first use and kept for the life of the process */
+registry_t* Jss::Registry()
+{
+	if (!registry_) {
+		registry_ = registry_open(JSS_REGISTRY);
+		if (!registry_)
+			printf("[jss] registry_open(%s) error\n", JSS_REGISTRY);
+	}
+	return registry_;
+}
+
+/* points at the current version of the registered dataset name; needs the registry lock */
+int Jss::AttachRegistered(const char *name)
+{
+	return AttachVersion(registry_lookup(registry_, name));
+}
+
+/* needs the registry lock, a version held before is the caller's to release */
+int Jss::AttachVersion(registry_entry_t *entry)
+{
+	jss_header_t *header;
+
+	if (!entry) return 0;
+	header = registry_header(registry_, registry_current(entry));
+	if (!header) return 0;
+
+	version_ = registry_acquire(registry_, entry);
+	entry_ = entry;
+	/* views already made stay with the old version */
+	ReleaseDataset();
+	header_ = header;
+	data_ = header->root;
+	size_ = header->used;
+	key_ = header->lastParsed;
+	return 1;
+}
+
+/*
+ * A root from open() or createJssObject() with a name moves to the newest
+ * version once one is published. The views it handed out stay on the
+ * version they were made from, which lives on until they are collected.
+ */
+void Jss::Refresh()
+{
+	int version = version_;
+	int warm = warm_ != NULL, opt = warm ? warm_->opt : 0;
+
+	if (!entry_ || registry_current(entry_) == version)
+		return;
+
+	/* the old version may be reclaimed once released, and the new one
+	   is warmed the way the old one was, but always in the background:
+	   the access that noticed the flip must not fault the whole of it */
+	StopWarm();
+	registry_lock(registry_);
+	if (!AttachVersion(entry_))
+		version = 0;		/* nothing to move to, keep what we have */
+	registry_unlock(registry_);
+	if (warm)
+		Warm(opt, 1);
+
+	if (version)
+		registry_release(registry_, version);
+}
+
+/*
+ * Parses json into the size bytes of arena past header, with no lock held.
+ * Sets header->used, and header->root once parsed. *full is set if the
+ * arena was too small, the caller may retry with more.
+ */
+int Jss::BuildInto(jss_header_t *header, size_t size, const char *json, int len, int *full, char *error)
+{
+	jss_value_t root = JSS_NONE;
+	builder_t *builder;
+	arena_t *arena;
+	int parsed;
+
+	*full = 0;
+	arena = arena_create(header->data, size);
+	if (!arena) {
+		sprintf(error, "Out of memory");
+		return 0;
+	}
+	userset_.memalloc = arenaalloc;
+	userset_.memfree = arenafree;
+	userset_.userdata = arena;
+
+	builder = builder_create(header, &userset_);
+	if (!builder) {
+		arena_del(arena);
+		userset_.userdata = NULL;
+		sprintf(error, "Out of memory");
+		return 0;
+	}
+	parsed = builder_parse(builder, json, len, &root, error);
+	*full = !parsed && builder->full;
+	builder_del(builder);
+
+	header->used = sizeof(jss_header_t) + arena->used;
+	if (parsed)
+		header->root = root;
+	arena_del(arena);
+	userset_.userdata = NULL;
+	return parsed;
+}
+
+/*
+ * Builds json into reserved registry space and publishes it as the new
+ * version of name, unless another process published the same json while
+ * this one waited for its turn on the name. The registry lock is only
+ * taken to reserve and to publish, so readers never wait for a build.
+ * The caller releases the version held before. The registry owns the
+ * memory, FreeStorage() leaves it alone.
+ */
+int Jss::BuildRegistered(const char *name, unsigned int crc, const char *json, int len, char *error)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry_->index);
+	registry_entry_t *entry;
+	jss_header_t *header;
+	size_t size;
+	int version = 0, parsed = 0, full, current, ok = 0;
+
+	if (!builder_measure(json, len, &size, error))
+		return 0;
+
+	registry_lock(registry_);
+	entry = registry_enter(registry_, name);
+	registry_unlock(registry_);
+	if (!entry) {
+		sprintf(error, "Registry full");
+		return 0;
+	}
+
+	/* one builder per name at a time, taken over if it dies */
+	once_begin(&entry->build);
+	registry_lock(registry_);
+
+	current = registry_current(entry);
+	if (current && index->versions[current].crc == crc) {
+		ok = AttachVersion(entry);
+	} else {
+		/* the estimate has headroom, doubling is only a fallback */
+		for (full = 1; full; size <<= 1) {
+			if (version)
+				registry_cancel(registry_, version);
+			header = registry_reserve(registry_, sizeof(jss_header_t) + size, &version);
+			if (!header) {
+				version = 0;
+				sprintf(error, "Registry full");
+				break;
+			}
+			registry_unlock(registry_);
+
+			memset(header, 0, sizeof(jss_header_t));
+			header->magic = JSS_MAGIC;
+			header->version = JSS_VERSION;
+			header->name = crc32(0, name, strlen(name));
+			header->lastParsed = crc;
+			parsed = BuildInto(header, size, json, len, &full, error);
+			if (parsed)
+				header->state = ONCE_READY;
+
+			registry_lock(registry_);
 		}
 
-		size_ = size;
-		key_ = key;
-		
-		return 1;
+		if (parsed && registry_publish(registry_, entry, version, header))
+			ok = AttachVersion(entry);
+		else if (version)
+			registry_cancel(registry_, version);
+		if (parsed && !ok)
+			sprintf(error, "Registry full");
 	}
-	
-	FreeStorage();
-	return 0;
+
+	registry_unlock(registry_);
+	once_end(&entry->build, 0);
+	return ok;
+}
+
+/* creates the segment of key, or maps the one another process just created */
+int Jss::AllocStorage(unsigned int key, shm_size_t size, int backend, int shmopt)
+{
+	shm_size_t realsize = sizeof(jss_header_t) + size;
+	char name[SHM_NAME_MAX];
+
+	if (backend == JSS_SHM_POSIX) {
+		sprintf(name, "/jss.%08x", key);
+		shm_ = shm_create_named(name, realsize, SHM_READWRITE|SHM_TRANSIENT|shmopt);
+	} else {
+		shm_ = shm_create(key, realsize, SHM_READWRITE|shmopt);
+	}
+	if (!shm_) {
+		printf("shm_create error\n");
+		return 0;
+	}
+
+	header_ = (jss_header_t*) shm_get(shm_);
+	size_ = shm_->size;
+	key_ = key;
+	return 1;
+}
+
+/* clears the header and sets up the arena; needs header_->state */
+int Jss::InitStorage()
+{
+	jss_header_t *header = header_;
+
+	memset(header, 0, offsetof(jss_header_t, state));
+	header->magic = JSS_MAGIC;
+	header->version = JSS_VERSION;
+	header->used = size_;
+
+	arena_ = arena_create(header->data, size_ - sizeof(jss_header_t));
+	if (!arena_) {
+		printf("arena_create error\n");
+		return 0;
+	}
+	userset_.memalloc = arenaalloc;
+	userset_.memfree = arenafree;
+	userset_.userdata = arena_;
+	return 1;
 }
 
 int Jss::EnterLock()
@@ -223,21 +720,20 @@ int Jss::LeaveLock()
 	return sema_leave(sema_);
 }
 
-void* Jss::OffsetToPtr(long offset)
+void* Jss::OffsetToPtr(int64_t offset)
 {
-	return (void *) ((unsigned char*) header_ - offset);
+	return JSS_PTR(header_, offset);
 }
 
-long Jss::PtrToOffset(void *ptr)
+int64_t Jss::PtrToOffset(void *ptr)
 {
-	return (unsigned char*) header_ - (unsigned char *) ptr;
+	return JSS_OFFSET(header_, ptr);
 }
 
-void Jss::SetData(jss_data_t *jdata)
+void Jss::SetData(jss_value_t value)
 {
-	data_ = jdata;
-	header_->start = PtrToOffset(jdata);
-	printf("SetData header_->start=%d\n", header_->start);
+	data_ = value;
+	header_->root = value;
 }
 
 void Jss::SetLastParsed(unsigned int crc)
@@ -251,130 +747,285 @@ unsigned int Jss::GetLastParsed()
 	return header_->lastParsed;
 }
 
-Handle<Value> Jss::ShallowClone(jss_data_t *jdata)
+/*
+ * The dataset record of the root's current version, shared by the views
+ * made from it. NULL while the root holds nothing.
+ */
+jss_dataset_t* Jss::Dataset()
 {
-	HandleScope scope;
+	jss_dataset_t *dataset;
+
+	if (dataset_ || !header_)
+		return dataset_;
+
+	dataset = new jss_dataset_t;
+	dataset->header = header_;
+	dataset->root = this;
+	dataset->version = version_;
+	dataset->users = 0;
+	dataset->idle = 0;
+	dataset->next = NULL;
+	/* without the cache views just aren't shared */
+	dataset->cache = wrapcache_create();
+	if (version_)
+		registry_hold(registry_, version_);
+	return dataset_ = dataset;
+}
+
+/* the root lets go of its dataset record, what was made from it keeps it */
+void Jss::ReleaseDataset()
+{
+	if (!dataset_)
+		return;
+	dataset_->root = NULL;
+	if (!dataset_->users && !dataset_->idle)
+		FreeDataset(dataset_);
+	dataset_ = NULL;
+}
+
+/* a view or an external string is made from dataset */
+void Jss::Use(jss_dataset_t *dataset)
+{
+	Local<Object> proto;
+
+	/* array views borrow Array.prototype so map/forEach/slice work through
+	   the indexed and "length" interceptors */
+	if (dataset->protos[0].IsEmpty()) {
+		for (int i = 0; i < 2; i++) {
+			proto = Object::New();
+			proto->SetHiddenValue(String::NewSymbol("jss"), dataset->root->handle_);
+			if (i) proto->SetPrototype(array_prototype_);
+			dataset->protos[i] = Persistent<Object>::New(proto);
+		}
+	}
+	dataset->users++;
+}
+
+/*
+ * One made from dataset was collected. External strings are finalized in
+ * the middle of a GC, where handles can't be disposed, so the prototypes
+ * wait for DropIdle().
+ */
+void Jss::Unuse(jss_dataset_t *dataset)
+{
+	if (--dataset->users || dataset->idle)
+		return;
+	dataset->idle = 1;
+	dataset->next = idle_;
+	idle_ = dataset;
+}
 
-	Local<Object> instance = constructor_template_->NewInstance(0, NULL);
-	Jss *cloned = Unwrap<Jss>(instance);
-	if (!cloned) {
-		scope.Close(Undefined());
+/* GC epilogue: nothing holds the root for the unused datasets any longer */
+void Jss::DropIdle(GCType, GCCallbackFlags)
+{
+	jss_dataset_t *dataset;
+
+	while ((dataset = idle_)) {
+		idle_ = dataset->next;
+		dataset->idle = 0;
+		if (dataset->users)
+			continue;
+		for (int i = 0; i < 2; i++) {
+			dataset->protos[i].Dispose();
+			dataset->protos[i].Clear();
+		}
+		if (!dataset->root)
+			FreeDataset(dataset);
 	}
+}
 
-	cloned->header_ = header_;
-	cloned->sema_ = sema_;
-	cloned->shm_ = shm_;
-	cloned->mp_ = mp_;
+void Jss::FreeDataset(jss_dataset_t *dataset)
+{
+	if (dataset->cache)
+		wrapcache_release(dataset->cache);
+	if (dataset->version)
+		registry_release(registry_, dataset->version);
+	delete dataset;
+}
 
-	cloned->size_ = size_;
-	cloned->key_ = key_;
+/*
+ * The view of the object or array at value. A view that is still alive is
+ * handed out again, so row.stats === row.stats and a loop over rows makes
+ * no garbage; the cache forgets a view when V8 collects it, see ViewWeak().
+ */
+Handle<Value> Jss::View(jss_dataset_t *dataset, jss_value_t value)
+{
+	HandleScope scope;
+	int64_t offset = jss_payload(value);
+	int array = jss_type(value) == JSS_ARRAY;
+	Persistent<Object> handle;
+	Local<Object> view;
+	Object *cached;
+
+	if (dataset->cache && (cached = (Object *) wrapcache_get(dataset->cache, offset))) {
+		return scope.Close(Local<Object>::New(Persistent<Object>(cached)));
+	}
 
-	cloned->userset_.memalloc = memalloc;
-	cloned->userset_.memfree = memfree;
+	Use(dataset);
+	view = view_constructor_->NewInstance();
+	view->SetAlignedPointerInInternalField(0, dataset);
+	view->SetAlignedPointerInInternalField(1, (void *) (intptr_t) (offset | (array ? JSS_VIEW_ARRAY : 0)));
+	view->SetPrototype(dataset->protos[array]);
 
-	cloned->data_ = jdata;
-	cloned->isCloned_ = true;
+	handle = Persistent<Object>::New(view);
+	handle.MakeWeak(dataset, ViewWeak);
+	if (dataset->cache)
+		wrapcache_put(dataset->cache, offset, *handle);
 
-	return scope.Close(instance);
+	return scope.Close(view);
 }
 
-jss_data_t* Jss::Parse(json_value *jval)
+void Jss::ViewWeak(Persistent<Value> object, void *param)
 {
-	jss_data_t *jdata = NULL, *value = NULL;
-	char *str = NULL;
-	hash_t *map = NULL;
-	int len;
+	jss_dataset_t *dataset = (jss_dataset_t *) param;
+	Handle<Object> view = Handle<Object>::Cast(object);
+	intptr_t field = (intptr_t) view->GetAlignedPointerFromInternalField(1);
+
+	/* the next access to the same record makes a new view */
+	if (dataset->cache)
+		wrapcache_remove(dataset->cache, field & ~(intptr_t) JSS_VIEW_ARRAY, *object);
+	object.Dispose();
+	Unuse(dataset);
+}
+
+/*
+ * Segment strings handed to V8 as they are, no decoding or copying: the
+ * ASCII ones as one byte strings, the others through the UTF-16 copy the
+ * builder made. Each keeps its dataset in use until V8 finalizes it.
+ */
+template <class Resource, class Char>
+class JssString : public Resource {
+public:
+	JssString(jss_dataset_t *dataset, const Char *data, size_t length)
+		: dataset_(dataset), data_(data), length_(length) {}
+	const Char* data() const { return data_; }
+	size_t length() const { return length_; }
+
+protected:
+	void Dispose()
+	{
+		Jss::Unuse(dataset_);
+		delete this;
+	}
+
+private:
+	jss_dataset_t *dataset_;
+	const Char *data_;
+	size_t length_;
+};
+
+typedef JssString<String::ExternalAsciiStringResource, char> JssAsciiString;
+typedef JssString<String::ExternalStringResource, uint16_t> JssWideString;
+
+Handle<String> Jss::ExternalString(jss_dataset_t *dataset, const jss_string_t *str)
+{
+	Use(dataset);
+	if (str->flags & JSS_STRING_ASCII)
+		return String::NewExternal(new JssAsciiString(dataset, str->data, str->length));
+	return String::NewExternal(new JssWideString(dataset, jss_string_utf16(str), str->units));
+}
+
+/*
+ * The dataset and value a view or a root stands for. A root first moves to
+ * the newest version of its name. NULL for a root that holds nothing, and
+ * for anything else.
+ */
+jss_dataset_t* Jss::Resolve(Handle<Object> holder, jss_value_t *value)
+{
+	intptr_t field;
+	Jss *jss;
 
-	jdata = (jss_data_t *) memalloc(1, sizeof(jss_data_t), mp_);
-	if (!jdata) {
+	if (IsView(holder)) {
+		field = (intptr_t) holder->GetAlignedPointerFromInternalField(1);
+		*value = jss_make(field & JSS_VIEW_ARRAY ? JSS_ARRAY : JSS_OBJECT, field & ~(intptr_t) JSS_VIEW_ARRAY);
+		return (jss_dataset_t *) holder->GetAlignedPointerFromInternalField(0);
+	}
+
+	if (!IsRoot(holder)) {
+		return NULL;
+	}
+	jss = Unwrap<Jss>(holder);
+	if (!jss) {
 		return NULL;
 	}
+	jss->Refresh();
+	*value = jss->data_;
+	return jss->Dataset();
+}
 
-	jdata->type = jval->type;
-	switch(jdata->type) {
-	case json_integer:
-		jdata->u.integer = jval->u.integer;
-		//printf("value %d\n", jval->u.integer);
-		break;
-	case json_double:
-		jdata->u.dbl = jval->u.dbl;
-		break;
-	case json_boolean:
-		jdata->u.boolean = jval->u.boolean;
-		break;
-	case json_null:
-		break;
-	case json_none:
-		break;
-	case json_string:
-		str = strndup(jval->u.string.ptr, mp_);
-		if (!str) goto error;
-		jdata->u.string.length = jval->u.string.length;
-		jdata->u.string.offset = PtrToOffset(str);
-		//printf("value %s\n", str);
-		break;
-	case json_object:
-		len = jval->u.object.length;
-		map = hash_create(len, &userset_);
-		if (!map) goto error;
-		for (int i=0; i<len; i++) {
-			str = strndup(jval->u.object.values[i].name, mp_);
-			if (!str) {
-				goto error;
-			}
+jss_array_t* Jss::GetArray(jss_dataset_t *dataset, jss_value_t value)
+{
+	if (jss_type(value) != JSS_ARRAY)
+		return NULL;
 
-	        //printf("key name = %s\n", str);
-            //printf("child\n");
-			value = Parse(jval->u.object.values[i].value);
-			if (!value) {
-				memfree(str, mp_);
-				goto error;
-			}
+	return (jss_array_t *) JSS_PTR(dataset->header, jss_payload(value));
+}
 
-			if (hash_insert(map, str, value) == HASH_FAIL) {
-				//DeleteJdata(jdata);
-				goto error;
-			}
-		}
-		jdata->u.objectoffset = PtrToOffset(map);
-		break;
-	case json_array:
-		len = jval->u.array.length;
-		map = hash_create(len, &userset_);
-		if (!map) goto error;
-
-		for (int i=0; i<len; i++) {
-			str = itoindex(i, mp_);
-			if (!str) {
-				goto error;
-			}
+jss_object_t* Jss::GetObject(jss_dataset_t *dataset, jss_value_t value)
+{
+	if (jss_type(value) != JSS_OBJECT)
+		return NULL;
+
+	return (jss_object_t *) JSS_PTR(dataset->header, jss_payload(value));
+}
 
-			//printf("key name = %s\n", str);
+Handle<Array> Jss::GetKeys(jss_dataset_t *dataset, jss_value_t value)
+{
+	HandleScope scope;
+	jss_object_t *object = GetObject(dataset, value);
+	jss_shape_t *shape;
+	jss_string_t *str;
+	Local<Array> result;
 
-			value = Parse(jval->u.array.values[i]);
-			if (!value) {
-				memfree(str, mp_);
-				goto error;
-			}
+	if (!object) {
+		return scope.Close(Array::New(0));
+	}
 
-			if (hash_insert(map, str, value) == HASH_FAIL) {
-				//DeleteJdata(jdata);
-				goto error;
-			}
-		}
-		jdata->u.objectoffset = PtrToOffset(map);
-		break;
+	result = Array::New();
+	shape = jss_object_shape(dataset->header, object);
+	for (unsigned int i=0, c=0; i<shape->size; i++) {
+		if (!shape->keys[i])
+			continue;
+		str = (jss_string_t *) JSS_PTR(dataset->header, shape->keys[i]);
+		result->Set(c++, String::New(str->data, str->length));
 	}
 
-	return jdata;
+	return scope.Close(result);
+}
+
+/* cell must point into the segment, short strings are read in place */
+Handle<Value> Jss::ToValue(jss_dataset_t *dataset, const jss_value_t *cell)
+{
+	HandleScope scope;
+	jss_value_t value = *cell;
+	jss_string_t *str;
+
+	switch(jss_type(value)) {
+	case JSS_OBJECT:
+	case JSS_ARRAY:
+		return scope.Close(View(dataset, value));
+	case JSS_INT:
+		return scope.Close(Number::New((double) jss_payload(value)));
+	case JSS_BIGINT:
+		return scope.Close(Number::New((double) *(json_int_t *) JSS_PTR(dataset->header, jss_payload(value))));
+	case JSS_DOUBLE:
+		return scope.Close(Number::New(*(double *) JSS_PTR(dataset->header, jss_payload(value))));
+	case JSS_SSTR:
+		return scope.Close(String::New(jss_sstr_ptr(cell), jss_sstr_length(value)));
+	case JSS_STRING:
+		str = (jss_string_t *) JSS_PTR(dataset->header, jss_payload(value));
+		if (str->length >= JSS_EXTERNAL_MIN && (str->flags & (JSS_STRING_ASCII | JSS_STRING_UTF16)))
+			return scope.Close(ExternalString(dataset, str));
+		return scope.Close(String::New(str->data, str->length));
+	case JSS_TRUE:
+		return scope.Close(Boolean::New(true));
+	case JSS_FALSE:
+		return scope.Close(Boolean::New(false));
+	case JSS_NULL:
+		return scope.Close(Null());
+	};
 
-error:
-	printf("alloc fail\n");
-	/*
-	if (jdata)
-		DeleteJdata(jdata);
-	*/
-	return NULL;
+	return scope.Close(Undefined());
 }
 
 void Jss::Init(Handle<Object> target)
@@ -391,7 +1042,22 @@ void Jss::Init(Handle<Object> target)
 	//tpl->PrototypeTemplate()->Set(String::NewSymbol("map"), FunctionTemplate::New(forEach)->GetFunction());
 	tpl->InstanceTemplate()->SetNamedPropertyHandler(GetNamedProperty, 0, 0, 0,EnumerateNamedProperty);
 	tpl->InstanceTemplate()->SetIndexedPropertyHandler(GetIndexedProperty, 0, 0, 0, EnumerateIndexedProperty);
+	root_template_ = Persistent<FunctionTemplate>::New(tpl);
 	constructor_template_ = Persistent<Function>::New(tpl->GetFunction());
+
+	/* a template of their own, so views can be told from other objects
+	   with two internal fields */
+	Local<FunctionTemplate> view = FunctionTemplate::New();
+	view->SetClassName(String::NewSymbol("JssView"));
+	view->InstanceTemplate()->SetInternalFieldCount(JSS_VIEW_FIELDS);
+	view->InstanceTemplate()->SetNamedPropertyHandler(GetNamedProperty, 0, 0, 0,EnumerateNamedProperty);
+	view->InstanceTemplate()->SetIndexedPropertyHandler(GetIndexedProperty, 0, 0, 0, EnumerateIndexedProperty);
+	view_template_ = Persistent<FunctionTemplate>::New(view);
+	view_constructor_ = Persistent<Function>::New(view->GetFunction());
+	V8::AddGCEpilogueCallback(DropIdle);
+
+	Local<Object> array = Context::GetCurrent()->Global()->Get(String::NewSymbol("Array"))->ToObject();
+	array_prototype_ = Persistent<Value>::New(array->Get(String::NewSymbol("prototype")));
 }
 
 Handle<Value> Jss::New(const Arguments& args) 
@@ -411,201 +1077,133 @@ Handle<Value> Jss::NewInstance(int argc, Handle<Value> argv[])
 	return scope.Close(instance);
 }
 
-void hash_enum_callback(const hash_t *tptr, int idx, char *key, void *data, void *userdata1, void *userdata2) {
-	Local<Array> *result = static_cast<Local<Array>*>(userdata1);
-	if (!strncmp(key, "IDX_", 4)) {
-		key += 4;
-	}
-	(*result)->Set(Integer::New(idx), String::New(key));
+/* an object createJssObject(), openImage() or open() returned */
+int Jss::IsRoot(Handle<Value> value)
+{
+	return value->IsObject() && root_template_->HasInstance(value);
 }
 
-void hash_enum_callback2(const hash_t *tptr, int idx, char *key, void *data, void *userdata1, void *userdata2) {
-	Local<Array> *result = static_cast<Local<Array>*>(userdata1);
-	Jss *jss = (Jss *) userdata2;
-	Handle<Value> subobj;
+/* an object read from a root, see View() */
+int Jss::IsView(Handle<Value> value)
+{
+	return value->IsObject() && value->ToObject()->InternalFieldCount() == JSS_VIEW_FIELDS &&
+			view_template_->HasInstance(value);
+}
 
-	if (!strncmp(key, "IDX_", 4)) {
-		key += 4;
-	}
+Handle<Array> Jss::EnumerateNamedProperty(const AccessorInfo& info) 
+{
+	HandleScope scope;
+	jss_dataset_t *dataset;
+	jss_value_t value;
 
-	jss_data_t *jdata = (jss_data_t *)data;
+	dataset = Resolve(info.Holder(), &value);
+	if (!dataset) {
+		return scope.Close(Array::New(0));
+	}
 
-	//printf("idx=%d, key=%s, jdata->type: %d\n", idx, key, jdata->type);
-	
-	
-	switch(jdata->type) {
-	case json_object:
-		//(*result)->Set(Object::New(idx), String::New(key));
-		//subobj = jss->ShallowClone(jdata);
-		//return scope.Close(subobj)
-		subobj = jss->ShallowClone(jdata);
-		(*result)->Set(Integer::New(atoi(key)), subobj);
-		break;
-	case json_array:
-		///ret_array = Array::New(hash_entries(object));
-		//hash_enumerator(object, hash_enum_callback2, &ret_array);
-		//return scope.Close(ret_array);
-		subobj = jss->ShallowClone(jdata);
-		(*result)->Set(Integer::New(atoi(key)), subobj);
-		break;
-	case json_integer:
-		
-		//printf("enum] int %d\n", jdata->u.integer);
-		(*result)->Set(Integer::New(atoi(key)), Number::New(jdata->u.integer));
-		break;
-	case json_double:
-		(*result)->Set(Integer::New(atoi(key)), Number::New(jdata->u.dbl));
-		//printf("enum] dbl %f\n", jdata->u.dbl);
-		break;
-	case json_string:
-		(*result)->Set(Integer::New(atoi(key)), String::New((char *) jss->OffsetToPtr(jdata->u.string.offset)));
-		//printf("enum] str %f\n", (char *) jss->OffsetToPtr(jdata->u.string.offset));
-		break;
-	case json_boolean:
-		(*result)->Set(Integer::New(atoi(key)), Boolean::New(jdata->u.boolean));
-		//printf("enum] b %f\n", jdata->u.boolean);
-		break;
-	case json_null:
-		(*result)->Set(Integer::New(atoi(key)), Null());
-		break;
-	case json_none:
-		break;
-	};
+	return scope.Close(GetKeys(dataset, value));
 }
 
-Handle<Array> Jss::EnumerateNamedProperty(const AccessorInfo& info) 
-{
+ Handle<Array> Jss::EnumerateIndexedProperty(const AccessorInfo &info) 
+ {
 	HandleScope scope;
 	Local<Array> result;
-	hash_t *object;
-	Jss *jss;
+	jss_dataset_t *dataset;
+	jss_array_t *array;
+	jss_value_t value;
 
-	jss = Unwrap<Jss>(info.Holder().As<Object>());
-	if (!jss) {
+	dataset = Resolve(info.Holder(), &value);
+	if (!dataset || !(array = GetArray(dataset, value))) {
 		return scope.Close(Array::New(0));
 	}
 
-	object = (hash_t *) jss->OffsetToPtr(jss->data_->u.objectoffset);
-	result = Array::New(hash_entries(object));
-	hash_enumerator(object, hash_enum_callback, &result);
+	result = Array::New(array->length);
+	for (int i=0; i<array->length; i++) {
+		result->Set(i, Integer::New(i));
+	}
 
 	return scope.Close(result);
 }
 
- Handle<Array> Jss::EnumerateIndexedProperty(const AccessorInfo &info) 
- {
-	 HandleScope scope;
-	 return scope.Close(Array::New(0));
-}
-int tc = 0;
 Handle<Value> Jss::GetNamedProperty(Local<String> name, const AccessorInfo &info)
 {
 	HandleScope scope;
-	jss_data_t *jdata;
-	hash_t *object;
-	char *str;
-	Local<Array> ret_array;
+	jss_dataset_t *dataset;
+	jss_value_t *cell;
+	jss_value_t value;
+	jss_object_t *object;
+	jss_array_t *array;
+
+	dataset = Resolve(info.Holder(), &value);
+	if (!dataset) {
+		return scope.Close(Undefined());
+	}
+
+	String::Utf8Value key(name);
+
+	/* must win over Array.prototype.length */
+	if ((array = GetArray(dataset, value)) && strcmp(*key, "length") == 0) {
+		return scope.Close(Integer::New(array->length));
+	}
 
 	Local<Value> property =  info.This()->GetRealNamedProperty(name);
 	if (!property.IsEmpty()) {
 		return scope.Close(property);
 	}
 
-	String::Utf8Value key(name);
-
 	if (strcmp(*key, "inspect") == 0) {
 		return scope.Close(Undefined());
 	}
 
-	Jss *jss = Unwrap<Jss>(info.This());
-	if (!jss) {
+	if (!(object = GetObject(dataset, value))) {
 		return scope.Close(Undefined());
 	}
 
-	if (!tc) {
-		printf("key=%s\n", *key);
-		printf("jss->data_(0x%x), jss->header_(0x%x)\n", jss->data_, jss->header_);
-		tc++;
-	}
-
-	//printf("key=%s\n", *key);
-	object = (hash_t *) jss->OffsetToPtr(jss->data_->u.objectoffset);
-	//printf("err?\n");
-	jdata = (jss_data_t *) hash_lookup(object, *key);
-	if (jdata == HASH_FAIL)
+	cell = jss_object_lookup(dataset->header, object, *key, key.length());
+	if (!cell)
 		return scope.Close(Undefined());
 
-
-	Handle<Value> subobj;
-
-	switch(jdata->type) {
-	case json_object:
-		subobj = jss->ShallowClone(jdata);
-		return scope.Close(subobj);
-	case json_array: {
-			//printf("array!! (%d)\n", hash_entries((hash_t *)jss->OffsetToPtr(jdata->u.objectoffset)));
-			ret_array = Array::New(hash_entries((hash_t *)jss->OffsetToPtr(jdata->u.objectoffset)));
-			hash_enumerator((hash_t *)jss->OffsetToPtr(jdata->u.objectoffset), hash_enum_callback2, &ret_array, (void*)jss);
-			return scope.Close(ret_array);
-
-		}
-	case json_integer:
-		return scope.Close(Number::New(jdata->u.integer));
-	case json_double:
-		return scope.Close(Number::New(jdata->u.dbl));
-	case json_string:
-		str = (char *) jss->OffsetToPtr(jdata->u.string.offset);
-		return scope.Close(String::New(str));
-	case json_boolean:
-		return scope.Close(Boolean::New(jdata->u.boolean));
-	case json_null:
-		return scope.Close(Null());
-	case json_none:
-		break;
-	};
-
-	return scope.Close(Undefined());
+	return scope.Close(ToValue(dataset, cell));
 }
 
 Handle<Value> Jss::GetIndexedProperty(uint32_t index, const AccessorInfo &info)
 {
 	HandleScope scope;
-	const char *format = "IDX_%d";
+	jss_dataset_t *dataset;
+	jss_value_t value;
+	jss_array_t *array;
 	char key[128];
 
-	Jss *jss = Unwrap<Jss>(info.This());
-	if (!jss) {
+	dataset = Resolve(info.Holder(), &value);
+	if (!dataset) {
 		return scope.Close(Undefined());
 	}
-	
-	sprintf(key, "%d", index);
 
-	Handle<Value> instance = GetNamedProperty(String::New(key), info);
-	if (instance->IsUndefined() || instance->IsNull()) {
-		sprintf(key, format, index);
-		instance = GetNamedProperty(String::New(key), info);
+	if ((array = GetArray(dataset, value))) {
+		if (index >= (uint32_t) array->length)
+			return scope.Close(Undefined());
+
+		return scope.Close(ToValue(dataset, &array->values[index]));
 	}
+	
+	/* objects may still use numeric keys, e.g. { "1": ... } */
+	sprintf(key, "%u", index);
 
-	return scope.Close(instance); 
+	return scope.Close(GetNamedProperty(String::New(key), info)); 
 }
 
 Handle<Value> Jss::forEach(const Arguments& args)
 {
 	HandleScope scope;
-	Local<Array> result;
-	hash_t *object;
-	Jss *jss;
+	jss_dataset_t *dataset;
+	jss_value_t value;
 
-	jss = Unwrap<Jss>(args.Holder().As<Object>());
-	if (!jss) {
+	dataset = Resolve(args.Holder(), &value);
+	if (!dataset) {
 		return scope.Close(Array::New(0));
 	}
 
-	object = (hash_t *) jss->OffsetToPtr(jss->data_->u.objectoffset);
-	result = Array::New(hash_entries(object));
-	hash_enumerator(object, hash_enum_callback, &result);
-
-	return scope.Close(result);
+	return scope.Close(GetKeys(dataset, value));
 }
 
 
@@ -619,97 +1217,442 @@ Handle<Value> Jss::forEach(const Arguments& args)
 	}																			\
 	String::Utf8Value var(args[i]->ToString());
 
+/*
+ * { prefault: true|'sync', mlock: bool }: warms the dataset in the
+ * background, or before the call returns. mlock alone implies prefault.
+ * Returns 0 if options ask for neither.
+ */
+static int WarmOptions(const Arguments& args, int i, int *opt, int *background)
+{
+	if (args.Length() <= i || !args[i]->IsObject())
+		return 0;
+
+	Local<Object> options = args[i]->ToObject();
+	Local<Value> prefault = options->Get(String::New("prefault"));
+	String::Utf8Value mode(prefault);
+
+	*opt = options->Get(String::New("mlock"))->BooleanValue() ? SHM_MLOCK : 0;
+	*background = !(prefault->IsString() && *mode && !strcmp(*mode, "sync"));
+	return prefault->BooleanValue() || *opt;
+}
+
 Handle<Value> CreateJssObject(const Arguments& args)
 {
 	HandleScope scope;
 	REQUIRE_ARGUMENT_STRING(0, jstr);
 	Handle<Value> instance;
 	Jss *jss;
-	jss_data_t *root;
-	json_value *jval;
+	char error[json_error_max];
 	unsigned int crc;
-	int len, allocsize;
-	sema_t sema = NULL;
+	int len;
+	int parsed = 0, stale = 0;
+	int backend = JSS_SHM_POSIX, shmopt = 0;
+	int warm, warmopt = 0, background = 0;
+	char name[REGISTRY_NAME_MAX] = "";
+	registry_t *registry;
+
+	/* { shm: 'posix'|'sysv', hugepages: bool, name: registry name,
+	     prefault, mlock: see WarmOptions() } */
+	warm = WarmOptions(args, 1, &warmopt, &background);
+	if (args.Length() > 1 && args[1]->IsObject()) {
+		Local<Object> options = args[1]->ToObject();
+		String::Utf8Value shm(options->Get(String::New("shm")));
+		if (*shm && !strcmp(*shm, "sysv"))
+			backend = JSS_SHM_SYSV;
+		if (options->Get(String::New("hugepages"))->BooleanValue())
+			shmopt |= SHM_HUGEPAGE;
+		if (options->Get(String::New("name"))->IsString()) {
+			String::Utf8Value str(options->Get(String::New("name")));
+			if (str.length() >= REGISTRY_NAME_MAX) {
+				return ThrowException(Exception::RangeError(String::New("name is too long")));
+			}
+			strcpy(name, *str);
+		}
+	}
 
 	for (;;) {
 		len = strlen(*jstr);
 		crc = crc32(0, *jstr, len);
-		allocsize = std::max(len*40, 1*1024*1024*10);
-		printf("jstrlen(%d), crc32(0x%x), allocsize(%d)\n", len, crc, allocsize);
 
 		instance = Jss::NewInstance(0, NULL);
 		jss = node::ObjectWrap::Unwrap<Jss>(instance->ToObject());
-		printf("jss(0x%x)\n", jss);
-
-		//sema = sema_create(crc);
-		
-		unsigned char *tt;
 		try {
-			//sema_enter(sema);
-			if (!jss->AllocStorage(crc, allocsize)) {
-				printf("[jss] AllocStorage error\n");
-				break;
-			}
-
-			if (jss->GetLastParsed() != crc) {
-				jval = json_parse(*jstr, len);
-				if (!jval) {
-					printf("[jss] json_parse error\n");
+			if (*name) {
+				/* a named dataset shares the registry regions instead of
+				   getting a segment of its own */
+				if (!(registry = Jss::Registry())) {
 					break;
 				}
-				root = jss->Parse(jval);
-				json_value_free(jval);
-				if (!root) {
-					printf("[jss] Parse error\n");
+				registry_lock(registry);
+				if (jss->AttachRegistered(name) && jss->key_ == crc) {
+					printf("[jss] %s crc32(0x%x) is already loaded.\n", name, crc);
+					parsed = 1;
+				}
+				registry_unlock(registry);
+
+				if (!parsed) {
+					/* a new version, readers of the old one carry on */
+					stale = jss->version_;
+					jss->version_ = 0;
+					parsed = jss->BuildRegistered(name, crc, *jstr, len, error);
+				}
+
+				if (stale)
+					registry_release(registry, stale);
+
+				if (!parsed) {
+					printf("[jss] %s: %s\n", name, error);
 					break;
 				}
-				
-				jss->SetData(root);
-				jss->SetLastParsed(crc);
+			} else if (!jss->LoadStorage(crc, *jstr, len, backend, shmopt, error)) {
+				printf("[jss] crc32(0x%x): %s\n", crc, error);
+				break;
 			} else {
-				printf("[jss] crc32(0x%x) is already loaded.\n", crc);
+				jss->TrackStorage();
 			}
-			printf("[jss] ROOT = 0x%x\n", root);
-			//sema_leave(sema);
-			//sema_del(sema);
-  
-			
-			printf("[jss] crc32(0x%x) has been loaded.\n", crc);
-
-			tt = (unsigned char*) jss->header_;
-			printf(">>>>> header_[%p]\n", jss->header_);
-			for (int i=1; i<256; i++) {
-				printf("0x%x ", tt[i]);
-				if (!(i%12)) { printf("addr 0x%x\n", &tt[i]); }
+			if (warm)
+				jss->Warm(warmopt, background);
+			if (jss_type(jss->data_) == JSS_ARRAY) {
+				instance->ToObject()->SetPrototype(Jss::array_prototype_);
 			}
-			printf("\ndata_ => 0x%x\n", jss->data_);
-
-			printf(">>>>> start[%p]\n", &(jss->header_->start));
-			printf(">>>>> start[%d]\n", jss->header_->start);
-			printf(">>>>> data_[%p]\n", jss->data_);
-			tt = (unsigned char*) jss->data_;
-			printf("ROOT 0x%x, 0x%x, 0x%x, 0x%x\n",tt[0], tt[1], tt[2], tt[3]);
-
-			printf("\n");
-			
-			//getchar();
-			return scope.Close(instance);		
+			printf("[jss] crc32(0x%x) has been loaded.\n", crc);
+			return scope.Close(instance);
 		} catch(...) {
 			break;
 		}
 	}
 
-	//sema_leave(sema);
-	//sema_del(sema);
 	jss->FreeStorage();
 	ThrowException(Exception::Error(String::New("")));
 	return scope.Close(Undefined());
 }
 
+/* open(name[, options]), a dataset registered by any process, or undefined */
+Handle<Value> Open(const Arguments& args)
+{
+	HandleScope scope;
+	REQUIRE_ARGUMENT_STRING(0, name);
+	Handle<Value> instance;
+	registry_t *registry;
+	Jss *jss;
+	int found, warmopt, background;
+
+	registry = Jss::Registry();
+	if (!registry) {
+		return ThrowException(Exception::Error(String::New("registry unavailable")));
+	}
+
+	instance = Jss::NewInstance(0, NULL);
+	jss = node::ObjectWrap::Unwrap<Jss>(instance->ToObject());
+
+	registry_lock(registry);
+	found = jss->AttachRegistered(*name);
+	registry_unlock(registry);
+	if (!found) {
+		return scope.Close(Undefined());
+	}
+	if (WarmOptions(args, 1, &warmopt, &background)) {
+		jss->Warm(warmopt, background);
+	}
+
+	if (jss_type(jss->data_) == JSS_ARRAY) {
+		instance->ToObject()->SetPrototype(Jss::array_prototype_);
+	}
+	return scope.Close(instance);
+}
+
+static Handle<Array> Owners(registry_t *registry, const uint32_t *holders)
+{
+	uint32_t pids[REGISTRY_LEASES];
+	int i, n = registry_owners(registry, holders, pids, REGISTRY_LEASES);
+	Handle<Array> owners = Array::New(n);
+
+	for (i = 0; i < n; i++)
+		owners->Set(i, Integer::NewFromUnsigned(pids[i]));
+	return owners;
+}
+
+/*
+ * list(), what the registry knows of: named datasets, one item per
+ * version still in memory, and segments of their own.
+ * { type: 'dataset'|'segment', name, size, owners: [pid], created,
+ *   lastAttach, ... } with times in seconds since the epoch.
+ */
+Handle<Value> List(const Arguments& args)
+{
+	HandleScope scope;
+	registry_t *registry;
+	registry_index_t *index;
+	registry_version_t *v;
+	registry_segment_t *segment;
+	registry_entry_t *entry;
+	Handle<Array> list;
+	Handle<Object> item;
+	char key[16];
+	int i, n = 0;
+
+	registry = Jss::Registry();
+	if (!registry) {
+		return ThrowException(Exception::Error(String::New("registry unavailable")));
+	}
+	index = (registry_index_t *) shm_get(registry->index);
+	list = Array::New();
+
+	registry_lock(registry);
+	registry_sweep(registry);
+
+	for (i = 1; i < REGISTRY_VERSIONS; i++) {
+		v = &index->versions[i];
+		if (!v->size || v->building)
+			continue;
+		entry = &index->entries[v->entry];
+		item = Object::New();
+		item->Set(String::New("type"), String::New("dataset"));
+		item->Set(String::New("name"), String::New(entry->name));
+		item->Set(String::New("version"), Integer::New(i));
+		item->Set(String::New("current"), Boolean::New(entry->current == (uint32_t) i));
+		item->Set(String::New("size"), Number::New((double) v->size));
+		item->Set(String::New("owners"), Owners(registry, v->holders));
+		item->Set(String::New("created"), Number::New((double) v->created));
+		item->Set(String::New("lastAttach"), Number::New((double) v->seen));
+		list->Set(n++, item);
+	}
+
+	for (i = 0; i < REGISTRY_SEGMENTS; i++) {
+		segment = &index->segments[i];
+		if (!segment->size)
+			continue;
+		item = Object::New();
+		item->Set(String::New("type"), String::New("segment"));
+		if (segment->name[0]) {
+			item->Set(String::New("name"), String::New(segment->name));
+		} else {
+			sprintf(key, "0x%08x", segment->key);
+			item->Set(String::New("name"), String::New(key));
+		}
+		item->Set(String::New("size"), Number::New((double) segment->size));
+		item->Set(String::New("owners"), Owners(registry, segment->holders));
+		item->Set(String::New("builder"), Integer::NewFromUnsigned(segment->builder));
+		item->Set(String::New("created"), Number::New((double) segment->created));
+		item->Set(String::New("lastAttach"), Number::New((double) segment->seen));
+		list->Set(n++, item);
+	}
+	registry_unlock(registry);
+
+	return scope.Close(list);
+}
+
+/* a compiled path, see CompilePath() */
+class JssPath : public node::ObjectWrap {
+public:
+	JssPath(path_t *path) : path_(path) {}
+	~JssPath() { path_del(path_); }
+
+	static void Init();
+	static Handle<Object> NewInstance(path_t *path);
+	static int HasInstance(Handle<Value> value);
+
+	static Persistent<FunctionTemplate> template_;
+	path_t *path_;
+};
+
+Persistent<FunctionTemplate> JssPath::template_;
+
+void JssPath::Init()
+{
+	Local<FunctionTemplate> tpl = FunctionTemplate::New();
+	tpl->SetClassName(String::NewSymbol("JssPath"));
+	tpl->InstanceTemplate()->SetInternalFieldCount(1);
+	template_ = Persistent<FunctionTemplate>::New(tpl);
+}
+
+Handle<Object> JssPath::NewInstance(path_t *path)
+{
+	HandleScope scope;
+	Local<Object> instance = template_->GetFunction()->NewInstance();
+	JssPath *wrapper = new JssPath(path);
+
+	wrapper->Wrap(instance);
+	return scope.Close(instance);
+}
+
+int JssPath::HasInstance(Handle<Value> value)
+{
+	return value->IsObject() && template_->HasInstance(value);
+}
+
+#define JSS_GET_INDEXES		16
+
+/*
+ * get(obj, path[, index...]), the value at path below obj, a root or any
+ * object read from one. The whole path is walked in the segment in this one
+ * call, nothing is made for the steps on the way. path is a string or from
+ * compilePath(), see path.h; each [*] in it takes the next index. undefined
+ * if some step isn't there.
+ */
+Handle<Value> Get(const Arguments& args)
+{
+	HandleScope scope;
+	uint32_t indexes[JSS_GET_INDEXES];
+	char error[json_error_max];
+	jss_dataset_t *dataset;
+	jss_value_t value, leaf;
+	int i, count, walked;
+
+	if (args.Length() < 2 || !(Jss::IsRoot(args[0]) || Jss::IsView(args[0]))) {
+		return ThrowException(Exception::TypeError(String::New("Argument 0 must be a jss object")));
+	}
+
+	count = args.Length() - 2;
+	if (count > JSS_GET_INDEXES) {
+		return ThrowException(Exception::RangeError(String::New("Too many indexes")));
+	}
+	for (i = 0; i < count; i++) {
+		if (!args[i + 2]->IsUint32()) {
+			return ThrowException(Exception::TypeError(String::New("Indexes must be array indexes")));
+		}
+		indexes[i] = args[i + 2]->Uint32Value();
+	}
+
+	dataset = Jss::Resolve(args[0]->ToObject(), &value);
+	if (!dataset) {
+		return scope.Close(Undefined());
+	}
+
+	if (JssPath::HasInstance(args[1])) {
+		JssPath *path = node::ObjectWrap::Unwrap<JssPath>(args[1]->ToObject());
+		walked = path_walk(path->path_, dataset->header, value, indexes, count, &leaf, error);
+	} else if (args[1]->IsString()) {
+		String::Utf8Value path(args[1]);
+		walked = path_walk_str(*path, dataset->header, value, indexes, count, &leaf, error);
+	} else {
+		return ThrowException(Exception::TypeError(String::New("Argument 1 must be a path")));
+	}
+	if (walked < 0) {
+		return ThrowException(Exception::SyntaxError(String::New(error)));
+	}
+	if (!walked) {
+		return ThrowException(Exception::RangeError(String::New(error)));
+	}
+
+	/* short strings are read from the cell, so leaf being a copy is fine */
+	return scope.Close(Jss::ToValue(dataset, &leaf));
+}
+
+/* compilePath(path), path parsed and its keys hashed once, for get() */
+Handle<Value> CompilePath(const Arguments& args)
+{
+	HandleScope scope;
+	REQUIRE_ARGUMENT_STRING(0, source);
+	char error[json_error_max];
+	Handle<Object> instance;
+	path_t *path;
+
+	path = path_compile(*source, error);
+	if (!path) {
+		return ThrowException(Exception::SyntaxError(String::New(error)));
+	}
+
+	instance = JssPath::NewInstance(path);
+	instance->Set(String::NewSymbol("source"), args[0]);
+	return scope.Close(instance);
+}
+
+/* saveImage(jss, path), jss must be the object createJssObject() returned */
+Handle<Value> SaveImage(const Arguments& args)
+{
+	HandleScope scope;
+	REQUIRE_ARGUMENT_STRING(1, path);
+	Jss *jss;
+
+	if (!Jss::IsRoot(args[0])) {
+		return ThrowException(Exception::TypeError(String::New("Argument 0 must be a jss object")));
+	}
+	jss = node::ObjectWrap::Unwrap<Jss>(args[0]->ToObject());
+	if (!jss || !jss->header_) {
+		return ThrowException(Exception::TypeError(String::New("Argument 0 must be a jss object")));
+	}
+
+	if (!image_save(jss->header_, *path)) {
+		return ThrowException(Exception::Error(String::New("saveImage failed")));
+	}
+	return scope.Close(Undefined());
+}
+
+/* openImage(path[, options]), maps a saved segment read-only, nothing is parsed */
+Handle<Value> OpenImage(const Arguments& args)
+{
+	HandleScope scope;
+	REQUIRE_ARGUMENT_STRING(0, path);
+	Handle<Value> instance;
+	jss_header_t *header;
+	image_t *image;
+	Jss *jss;
+	int warmopt, background;
+
+	image = image_open(*path);
+	if (!image) {
+		return ThrowException(Exception::Error(String::New("openImage failed")));
+	}
+	header = image_header(image);
+
+	instance = Jss::NewInstance(0, NULL);
+	jss = node::ObjectWrap::Unwrap<Jss>(instance->ToObject());
+	jss->image_ = image;
+	jss->header_ = header;
+	jss->data_ = header->root;
+	jss->size_ = image->size;
+	jss->key_ = header->lastParsed;
+	if (WarmOptions(args, 1, &warmopt, &background)) {
+		jss->Warm(warmopt, background);
+	}
+
+	if (jss_type(jss->data_) == JSS_ARRAY) {
+		instance->ToObject()->SetPrototype(Jss::array_prototype_);
+	}
+	return scope.Close(instance);
+}
+
+/*
+ * warmup(jss), how far prefaulting a root got: { total, done: bytes,
+ * ready: bool, locked: bool }, or undefined if it wasn't asked for.
+ * A readiness probe waits for ready.
+ */
+Handle<Value> Warmup(const Arguments& args)
+{
+	HandleScope scope;
+	Handle<Object> progress;
+	Jss *jss;
+
+	if (!Jss::IsRoot(args[0])) {
+		return ThrowException(Exception::TypeError(String::New("Argument 0 must be a jss object")));
+	}
+	jss = node::ObjectWrap::Unwrap<Jss>(args[0]->ToObject());
+	if (!jss || !jss->warm_) {
+		return scope.Close(Undefined());
+	}
+
+	progress = Object::New();
+	progress->Set(String::New("total"), Number::New((double) jss->warm_->size));
+	progress->Set(String::New("done"), Number::New((double) jss->warm_->done));
+	progress->Set(String::New("ready"), Boolean::New(jss->warm_->state != JSS_WARM_RUNNING));
+	progress->Set(String::New("locked"), Boolean::New(jss->warm_->state == JSS_WARM_DONE &&
+														(jss->warm_->opt & SHM_MLOCK)));
+	return scope.Close(progress);
+}
+
 void InitAll(Handle<Object> exports)
 {
 	NODE_SET_METHOD(exports, "createJssObject", CreateJssObject);
+	NODE_SET_METHOD(exports, "saveImage", SaveImage);
+	NODE_SET_METHOD(exports, "openImage", OpenImage);
+	NODE_SET_METHOD(exports, "open", Open);
+	NODE_SET_METHOD(exports, "list", List);
+	NODE_SET_METHOD(exports, "warmup", Warmup);
+	NODE_SET_METHOD(exports, "get", Get);
+	NODE_SET_METHOD(exports, "compilePath", CompilePath);
 	Jss::Init(exports);
+	JssPath::Init();
 }
 
 NODE_MODULE(jss, InitAll)
@@ -0,0 +1,231 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "shm.h"
+#include "registry.h"
+
+/**
+ Looks after the segments a registry knows of, see registry.h.
+
+ jssadm [-r registry] list
+ jssadm [-r registry] sweep
+ jssadm [-r registry] [-i seconds] [-n] evict [name...]
+
+ list prints every dataset version and standalone segment with its size,
+ owning pids and seconds since it was last attached. sweep drops the
+ leases of processes that are gone, which frees whatever only they held.
+ evict removes what nobody holds: segments, and datasets with their
+ current version. With names only those, and a name that matches
+ nothing fails the command; otherwise everything idle for at least -i
+ seconds (3600). -n only says what would go.
+ */
+
+#define DEFAULT_IDLE	3600
+
+static const char *registry_name = "/jss.registry";
+static long idle = DEFAULT_IDLE;
+static int dry = 0;
+
+static void usage()
+{
+	fprintf(stderr, "usage: jssadm [-r registry] [-i seconds] [-n] list | sweep | evict [name...]\n");
+	exit(2);
+}
+
+static long idle_for(int64_t created, int64_t seen)
+{
+	return (long) (time(NULL) - (seen > created ? seen : created));
+}
+
+static void print_owners(registry_t *registry, const uint32_t *holders)
+{
+	uint32_t pids[8];
+	int i, n = registry_owners(registry, holders, pids, 8);
+
+	if (!n)
+		printf(" -");
+	for (i = 0; i < n; i++)
+		printf("%s%u", i ? "," : " ", pids[i]);
+	if (n == 8)
+		printf(",...");
+	printf("\n");
+}
+
+static void segment_name(registry_segment_t *segment, char *name)
+{
+	if (segment->name[0])
+		snprintf(name, REGISTRY_NAME_MAX, "%s", segment->name);
+	else
+		snprintf(name, REGISTRY_NAME_MAX, "0x%08x", segment->key);
+}
+
+static int list(registry_t *registry)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	registry_version_t *v;
+	registry_entry_t *entry;
+	char name[REGISTRY_NAME_MAX];
+	int i;
+
+	printf("%-8s %-32s %12s %8s  owners\n", "type", "name", "size", "idle");
+	for (i = 1; i < REGISTRY_VERSIONS; i++) {
+		v = &index->versions[i];
+		if (!v->size)
+			continue;
+		if (v->building) {
+			printf("%-8s %-32s %12lld %8ld ", "building", "-", (long long) v->size, idle_for(v->created, v->seen));
+			print_owners(registry, v->holders);
+			continue;
+		}
+		entry = &index->entries[v->entry];
+		snprintf(name, sizeof(name), "%s@%d%s", entry->name, i, entry->current == (uint32_t) i ? "" : "(old)");
+		printf("%-8s %-32s %12lld %8ld ", "dataset", name, (long long) v->size, idle_for(v->created, v->seen));
+		print_owners(registry, v->holders);
+	}
+	for (i = 0; i < REGISTRY_SEGMENTS; i++) {
+		registry_segment_t *segment = &index->segments[i];
+		if (!segment->size)
+			continue;
+		segment_name(segment, name);
+		printf("%-8s %-32s %12lld %8ld ", "segment", name, (long long) segment->size,
+				idle_for(segment->created, segment->seen));
+		print_owners(registry, segment->holders);
+	}
+	return 1;
+}
+
+/* found[i] is set once names[i] matched something */
+static int wanted(const char *name, char **names, int count, int *found, long idle_seconds)
+{
+	int i, match = 0;
+
+	if (!count)
+		return idle_seconds >= idle;
+	for (i = 0; i < count; i++) {
+		if (!strcmp(names[i], name))
+			match = found[i] = 1;
+	}
+	return match;
+}
+
+static int held(registry_t *registry, const uint32_t *holders)
+{
+	uint32_t pid;
+
+	return registry_owners(registry, holders, &pid, 1);
+}
+
+/* old versions need nothing, they go by themselves once unheld */
+static int evict(registry_t *registry, char **names, int count)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	registry_entry_t *entry;
+	registry_version_t *v;
+	registry_segment_t *segment;
+	char name[REGISTRY_NAME_MAX];
+	int i, ok = 1, *found;
+
+	found = (int *) calloc(count ? count : 1, sizeof(int));
+	if (!found) {
+		fprintf(stderr, "jssadm: out of memory\n");
+		return 0;
+	}
+
+	for (i = 0; i < REGISTRY_SLOTS; i++) {
+		entry = &index->entries[i];
+		if (!entry->hash || !entry->current)
+			continue;
+		v = &index->versions[entry->current];
+		if (!wanted(entry->name, names, count, found, idle_for(v->created, v->seen)))
+			continue;
+		if (held(registry, v->holders)) {
+			if (count) {
+				printf("%s is held by", entry->name);
+				print_owners(registry, v->holders);
+				ok = 0;
+			}
+			continue;
+		}
+		printf("%s %s, %lld bytes\n", dry ? "would evict" : "evicted", entry->name, (long long) v->size);
+		if (!dry)
+			registry_unpublish(registry, entry);
+	}
+
+	for (i = 0; i < REGISTRY_SEGMENTS; i++) {
+		segment = &index->segments[i];
+		if (!segment->size)
+			continue;
+		segment_name(segment, name);
+		if (!wanted(name, names, count, found, idle_for(segment->created, segment->seen)))
+			continue;
+		if (held(registry, segment->holders)) {
+			if (count) {
+				printf("%s is held by", name);
+				print_owners(registry, segment->holders);
+				ok = 0;
+			}
+			continue;
+		}
+		printf("%s %s, %lld bytes\n", dry ? "would evict" : "evicted", name, (long long) segment->size);
+		if (!dry)
+			registry_remove_segment(segment);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!found[i]) {
+			printf("%s is not in the registry\n", names[i]);
+			ok = 0;
+		}
+	}
+	free(found);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	registry_t *registry;
+	int i, swept, ok = 0;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-r")) {
+			if (++i == argc) usage();
+			registry_name = argv[i];
+		} else if (!strcmp(argv[i], "-i")) {
+			if (++i == argc) usage();
+			idle = atol(argv[i]);
+		} else if (!strcmp(argv[i], "-n")) {
+			dry = 1;
+		} else {
+			usage();
+		}
+	}
+	if (i == argc) usage();
+
+	registry = registry_open(registry_name);
+	if (!registry) {
+		fprintf(stderr, "jssadm: can't open %s\n", registry_name);
+		return 1;
+	}
+
+	registry_lock(registry);
+	/* opening swept already, most of the time there's nothing left */
+	swept = registry->swept + registry_sweep(registry);
+	if (!strcmp(argv[i], "list")) {
+		ok = list(registry);
+	} else if (!strcmp(argv[i], "sweep")) {
+		printf("%d lease(s) of gone processes swept\n", swept);
+		ok = 1;
+	} else if (!strcmp(argv[i], "evict")) {
+		ok = evict(registry, argv + i + 1, argc - i - 1);
+	} else {
+		registry_unlock(registry);
+		registry_close(registry);
+		usage();
+	}
+	registry_unlock(registry);
+
+	registry_close(registry);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,299 @@
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "json.h"
+#include "jssdata.h"
+#include "builder.h"
+#include "arena.h"
+#include "image.h"
+#include "crc32.h"
+#include "error.h"
+
+/**
+ Offline compiler: turns JSON files into segment images that the module
+ maps with openImage(), so serving hosts never parse.
+
+ jssc [-o outdir] [-q] <file.json | dir>...
+
+ Directories are walked recursively for *.json. Every image is written
+ next to its source as name.jss, or under outdir with the same relative
+ path. Exits non-zero if any file failed.
+ */
+
+static const char *outdir = NULL;
+static int quiet = 0;
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void* alloc(int cnt, size_t size, void *arena)
+{
+	void *p = arena_alloc((arena_t *) arena, cnt*size, ARENA_ALIGN_8);
+
+	if (p) memset(p, 0, cnt*size);
+	return p;
+}
+
+static void release(void *, void *)
+{
+}
+
+static char* read_file(const char *path, size_t *length)
+{
+	FILE *fp = fopen(path, "rb");
+	char *buf = NULL;
+	long size;
+
+	for (;;) {
+		if (!fp) break;
+		if (fseek(fp, 0, SEEK_END) < 0 || (size = ftell(fp)) < 0) break;
+		rewind(fp);
+
+		buf = (char *) malloc(size + 1);
+		if (!buf) break;
+		if (fread(buf, 1, size, fp) != (size_t) size) break;
+		buf[size] = '\0';
+
+		fclose(fp);
+		*length = size;
+		return buf;
+	}
+
+	if (fp) fclose(fp);
+	free(buf);
+	return NULL;
+}
+
+/* creates every missing directory of path, but not path itself */
+static int make_parents(const char *path)
+{
+	char dir[1024];
+	char *p;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	for (p = dir + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(dir, 0777) < 0 && errno != EEXIST)
+			return 0;
+		*p = '/';
+	}
+	return 1;
+}
+
+/* source relative to root, with the .json extension replaced */
+static void image_path(const char *source, const char *root, char *path, size_t size)
+{
+	const char *rel = source;
+	const char *dot;
+	int n;
+
+	if (outdir) {
+		if (root && !strncmp(source, root, strlen(root)))
+			rel = source + strlen(root);
+		else if (strrchr(source, '/'))
+			rel = strrchr(source, '/') + 1;
+		while (*rel == '/')
+			rel++;
+		n = snprintf(path, size, "%s/%s", outdir, rel);
+	} else {
+		n = snprintf(path, size, "%s", source);
+	}
+
+	dot = strrchr(path, '.');
+	if (dot && dot > strrchr(path, '/') && !strcmp(dot, ".json"))
+		n = dot - path;
+	snprintf(path + n, size - n, ".jss");
+}
+
+/*
+ * Builds source into an arena sized by builder_measure(), doubled for as
+ * long as the segment still fills up.
+ */
+static int compile(const char *source, const char *root)
+{
+	char error[json_error_max];
+	char path[1024];
+	jss_header_t *header = NULL;
+	builder_t *builder = NULL;
+	arena_t *arena = NULL;
+	hash_userset_t userset;
+	jss_value_t value;
+	size_t length, size, estimate;
+	double started = now();
+	char *json;
+	unsigned int strings = 0, shapes = 0;
+	int built = 0;
+
+	json = read_file(source, &length);
+	if (!json) {
+		fprintf(stderr, "jssc: %s: %s\n", source, strerror(errno));
+		return 0;
+	}
+
+	if (!builder_measure(json, length, &estimate, error)) {
+		fprintf(stderr, "jssc: %s: %s\n", source, error);
+		free(json);
+		return 0;
+	}
+
+	size = estimate;
+	for (;;) {
+		header = (jss_header_t *) calloc(1, sizeof(jss_header_t) + size);
+		arena = header ? arena_create(header->data, size) : NULL;
+		if (!arena) {
+			sprintf(error, "Out of memory");
+			break;
+		}
+		header->magic = JSS_MAGIC;
+		header->version = JSS_VERSION;
+		header->lastParsed = crc32(0, json, length);
+
+		userset.memalloc = alloc;
+		userset.memfree = release;
+		userset.userdata = arena;
+
+		builder = builder_create(header, &userset);
+		if (!builder) {
+			sprintf(error, "Out of memory");
+			break;
+		}
+		if (builder_parse(builder, json, length, &value, error)) {
+			strings = builder->string_count;
+			shapes = builder->shape_count;
+			built = 1;
+			break;
+		}
+		if (!builder->full)
+			break;
+
+		builder_del(builder);
+		arena_del(arena);
+		free(header);
+		builder = NULL;
+		arena = NULL;
+		header = NULL;
+		size <<= 1;
+	}
+
+	builder_del(builder);
+	builder = NULL;
+
+	if (built) {
+		header->root = value;
+		header->used = sizeof(jss_header_t) + arena->used;
+
+		image_path(source, root, path, sizeof(path));
+		if (!make_parents(path) || !image_save(header, path)) {
+			snprintf(error, sizeof(error), "can't write %s", path);
+		} else {
+			if (!quiet) {
+				printf("%s -> %s: %.1f KB json, %.1f KB image (%.1f KB estimated), %u strings, %u shapes, %.0f ms\n",
+					source, path, length / 1024.0, header->used / 1024.0,
+					(sizeof(jss_header_t) + estimate) / 1024.0, strings, shapes,
+					(now() - started) * 1000);
+			}
+			arena_del(arena);
+			free(header);
+			free(json);
+			return 1;
+		}
+	}
+
+	fprintf(stderr, "jssc: %s: %s\n", source, error);
+	arena_del(arena);
+	free(header);
+	free(json);
+	return 0;
+}
+
+static int compile_dir(const char *dir, const char *root)
+{
+	char path[1024];
+	struct dirent *entry;
+	struct stat st;
+	const char *dot;
+	DIR *dp;
+	int ok = 1;
+
+	dp = opendir(dir);
+	if (!dp) {
+		fprintf(stderr, "jssc: %s: %s\n", dir, strerror(errno));
+		return 0;
+	}
+
+	while ((entry = readdir(dp))) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		if (stat(path, &st) < 0)
+			continue;
+
+		if (S_ISDIR(st.st_mode)) {
+			ok &= compile_dir(path, root);
+		} else {
+			dot = strrchr(entry->d_name, '.');
+			if (dot && !strcmp(dot, ".json"))
+				ok &= compile(path, root);
+		}
+	}
+	closedir(dp);
+
+	return ok;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: jssc [-o outdir] [-q] <file.json | dir>...\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct stat st;
+	int i, ok = 1, inputs = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-o")) {
+			if (++i == argc) usage();
+			outdir = argv[i];
+		} else if (!strcmp(argv[i], "-q")) {
+			quiet = 1;
+		} else if (argv[i][0] == '-') {
+			usage();
+		}
+	}
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-o")) {
+			i++;
+			continue;
+		}
+		if (argv[i][0] == '-')
+			continue;
+
+		inputs++;
+		if (stat(argv[i], &st) < 0) {
+			fprintf(stderr, "jssc: %s: %s\n", argv[i], strerror(errno));
+			ok = 0;
+		} else if (S_ISDIR(st.st_mode)) {
+			ok &= compile_dir(argv[i], argv[i]);
+		} else {
+			ok &= compile(argv[i], NULL);
+		}
+	}
+	if (!inputs) usage();
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,177 @@
+#ifndef _JSSDATA_H
+#define _JSSDATA_H
+
+#include <stdint.h>
+#include <string.h>
+#include "json.h"
+#include "phash.h"
+
+/*
+ * Segment layout shared by the builder and the accessors.
+ *
+ * Everything inside a segment is addressed by offsets from the header
+ * (header - ptr, see JSS_OFFSET) so a segment can be attached anywhere.
+ * Offsets are 64 bit wherever they are stored, 56 in a value cell, so a
+ * dataset can be larger than 2 GB; sizes and counts of single records
+ * stay 32 bit.
+ */
+
+#define JSS_MAGIC	0x5F4A5353		/* '_JSS' as gcc reads it, images keep working */
+
+#define JSS_PTR(base, offset)		((void *) ((unsigned char *) (base) - (offset)))
+#define JSS_OFFSET(base, ptr)		((unsigned char *) (base) - (unsigned char *) (ptr))
+
+/*
+ * A value is one 8 byte cell. The low byte is the tag: the type in the low
+ * nibble and, for inline strings, the length in the high nibble. The other
+ * 7 bytes hold the payload: null, booleans, 56 bit integers and strings of
+ * up to 7 bytes are stored in the cell itself, everything else is an offset
+ * (same base as JSS_OFFSET) to an out-of-line record.
+ *
+ * Inline strings live in the cell's memory right after the tag byte, which
+ * assumes a little endian host like the rest of the segment format.
+ */
+typedef uint64_t jss_value_t;
+
+enum {
+	JSS_NONE = 0,
+	JSS_NULL,
+	JSS_FALSE,
+	JSS_TRUE,
+	JSS_INT,			/* inline, 56 bit signed */
+	JSS_SSTR,			/* inline, up to JSS_SSTR_MAX bytes */
+	JSS_BIGINT,			/* offset to json_int_t */
+	JSS_DOUBLE,			/* offset to double */
+	JSS_STRING,			/* offset to jss_string_t */
+	JSS_OBJECT,			/* offset to jss_object_t */
+	JSS_ARRAY			/* offset to jss_array_t */
+};
+
+#define JSS_SSTR_MAX		7
+#define JSS_INT_MIN			(-((json_int_t) 1 << 55))
+#define JSS_INT_MAX			(((json_int_t) 1 << 55) - 1)
+
+#define jss_type(v)				((int) ((v) & 0x0F))
+#define jss_payload(v)			((int64_t) (v) >> 8)
+#define jss_make(type, payload)	(((uint64_t) (int64_t) (payload) << 8) | (type))
+
+#define jss_sstr_length(v)		((unsigned int) (((v) >> 4) & 0x0F))
+#define jss_sstr_ptr(cell)		((const char *) (cell) + 1)
+
+/* bumped on every layout change, older segments and images are rebuilt */
+#define JSS_VERSION	4
+
+typedef struct jss_header_t {
+	unsigned int magic;
+	unsigned int version;
+
+	unsigned int name;
+
+	unsigned int lastParsed;
+	uint64_t used;		/* bytes from the header to the end of the last record */
+	jss_value_t root;
+	unsigned int flags;	/* reserved, 0 */
+
+	/* ONCE_EMPTY -> taken by the builder -> ONCE_READY, see once.h; kept
+	   last so the header can be cleared without touching it */
+	volatile uint32_t state;
+
+	unsigned char data[];
+} jss_header_t;
+
+/*
+ * Object keys and long string values, interned: equal strings share one.
+ * What a reader needs to hand a string to V8 without looking at its bytes
+ * is worked out at build time: whether it is plain ASCII and, for the long
+ * ones that are not, a UTF-16 copy right after the UTF-8 bytes.
+ */
+typedef struct jss_string_t {
+	unsigned int length;		/* bytes, the NUL not counted */
+	unsigned int flags;			/* JSS_STRING_* */
+	unsigned int units;			/* UTF-16 code units, the length V8 sees */
+	char data[];				/* NUL terminated */
+} jss_string_t;
+
+#define JSS_STRING_ASCII	0x01		/* 7 bit only, units == length */
+#define JSS_STRING_UTF16	0x02		/* has the UTF-16 copy */
+
+/* non-ASCII strings of at least this many bytes get the UTF-16 copy */
+#define JSS_STRING_WIDE_MIN		64
+
+/* past the NUL, 2 byte aligned as data[] starts at an even offset */
+#define jss_string_utf16(s)		((const uint16_t *) ((s)->data + (((s)->length + 2) & ~1u)))
+#define jss_string_bytes(length, units, flags)	\
+	(sizeof(jss_string_t) + (((length) + 2) & ~1u) + ((flags) & JSS_STRING_UTF16 ? (units)*sizeof(uint16_t) : 0))
+
+typedef struct jss_array_t {
+	int length;
+	jss_value_t values[];
+} jss_array_t;
+
+/*
+ * Objects with the same key set share one shape: the keys frozen into a
+ * minimal perfect hash (see phash.h). keys[] holds the interned key of
+ * every slot (offset to jss_string_t, 0 for an unused slot) and is
+ * followed by the per bucket displacements. An object is then only its
+ * shape and one value per slot, JSS_NONE in unused slots.
+ */
+typedef struct jss_shape_t {
+	unsigned int size;			/* slots */
+	unsigned int buckets;
+	unsigned int length;		/* keys */
+	unsigned int reserved;
+	int64_t keys[];
+} jss_shape_t;
+
+#define jss_shape_disp(s)		((uint32_t *) ((s)->keys + (s)->size))
+#define jss_shape_bytes(size, buckets)	\
+	(sizeof(jss_shape_t) + (size)*sizeof(int64_t) + (buckets)*sizeof(uint32_t))
+
+/* as many values as the shape has slots */
+typedef struct jss_object_t {
+	int64_t shape;
+	jss_value_t values[];
+} jss_object_t;
+
+#define jss_object_shape(header, o)	((jss_shape_t *) JSS_PTR(header, (o)->shape))
+
+/* slot of key in every object of this shape, or -1; h is phash_hash(key, length) */
+static inline int jss_shape_find(void *header, jss_shape_t *shape, uint64_t h,
+									const char *key, size_t length)
+{
+	unsigned int slot = phash_slot(h, jss_shape_disp(shape), shape->buckets, shape->size);
+	int64_t keyoffset = shape->keys[slot];
+	jss_string_t *s;
+
+	if (!keyoffset)
+		return -1;
+
+	s = (jss_string_t *) JSS_PTR(header, keyoffset);
+	if (s->length != length || memcmp(s->data, key, length))
+		return -1;
+
+	return (int) slot;
+}
+
+static inline jss_value_t* jss_object_find(void *header, jss_object_t *o, uint64_t h,
+											const char *key, size_t length)
+{
+	int slot = jss_shape_find(header, jss_object_shape(header, o), h, key, length);
+
+	return slot < 0 ? NULL : &o->values[slot];
+}
+
+static inline jss_value_t* jss_object_lookup(void *header, jss_object_t *o, const char *key, size_t length)
+{
+	return jss_object_find(header, o, phash_hash(key, length), key, length);
+}
+
+static inline jss_value_t jss_make_sstr(const char *str, unsigned int length)
+{
+	jss_value_t v = 0;
+
+	memcpy((char *) &v + 1, str, length);
+	return v | (length << 4) | JSS_SSTR;
+}
+
+#endif
@@ -0,0 +1,112 @@
+#if defined (_WIN32) || defined (_WIN64)
+#include <windows.h>
+
+#else
+#include <sys/syscall.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#if defined (__linux__)
+#include <linux/futex.h>
+#endif
+#endif
+
+#include <limits.h>
+#include <stdint.h>
+#include "error.h"
+#include "once.h"
+
+/* how often a waiter checks that the builder is still alive */
+#define ONCE_POLL_MS	100
+
+#if defined (_WIN32) || defined (_WIN64)
+#define CAS(p, o, n)	(InterlockedCompareExchange((volatile LONG *) (p), (LONG) (n), (LONG) (o)) == (LONG) (o))
+#define BARRIER()		MemoryBarrier()
+#else
+#define CAS(p, o, n)	__sync_bool_compare_and_swap(p, o, n)
+#define BARRIER()		__sync_synchronize()
+#endif
+
+static uint32_t self()
+{
+#if defined (_WIN32) || defined (_WIN64)
+	return ((uint32_t) GetCurrentProcessId() << 2) | 1;
+#else
+	return ((uint32_t) getpid() << 2) | 1;
+#endif
+}
+
+int once_alive(uint32_t pid)
+{
+#if defined (_WIN32) || defined (_WIN64)
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+	int running;
+
+	if (!process)
+		return GetLastError() == ERROR_ACCESS_DENIED;
+	running = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+	CloseHandle(process);
+	return running;
+#else
+	return kill((pid_t) pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+/* sleeps while *word is still seen, or for at most ONCE_POLL_MS */
+static void wait_word(volatile uint32_t *word, uint32_t seen)
+{
+#if defined (_WIN32) || defined (_WIN64)
+	Sleep(ONCE_POLL_MS);
+#elif defined (__linux__)
+	struct timespec timeout = { 0, ONCE_POLL_MS * 1000000L };
+	syscall(SYS_futex, word, FUTEX_WAIT, seen, &timeout, NULL, 0);
+#else
+	usleep(ONCE_POLL_MS * 1000);
+#endif
+}
+
+static void wake(volatile uint32_t *word)
+{
+#if defined (__linux__)
+	syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+/* 1 if the caller now holds the word, 0 once it is ONCE_READY */
+int once_begin(volatile uint32_t *word)
+{
+	uint32_t seen;
+
+	for (;;) {
+		seen = *word;
+		if (seen == ONCE_READY) {
+			/* whatever was built before the word flipped is visible now */
+			BARRIER();
+			return 0;
+		}
+		/* our own pid can only be left over from a dead process that had it */
+		if (seen == ONCE_EMPTY || seen == self() || !once_alive(seen >> 2)) {
+			if (CAS(word, seen, self()))
+				return 1;
+			continue;
+		}
+		wait_word(word, seen);
+	}
+}
+
+/* 1 if the word is ONCE_READY, without waiting or taking it */
+int once_ready(const volatile uint32_t *word)
+{
+	if (*word != ONCE_READY)
+		return 0;
+	BARRIER();
+	return 1;
+}
+
+void once_end(volatile uint32_t *word, int ready)
+{
+	BARRIER();
+	*word = ready ? ONCE_READY : ONCE_EMPTY;
+	wake(word);
+}
@@ -0,0 +1,38 @@
+#ifndef _ONCE_H
+#define _ONCE_H
+
+#include <stdint.h>
+
+/**
+ Build-once coordination on a 32 bit word in shared memory.
+
+ if (once_begin(&header->state)) {
+     ... build ...
+     once_end(&header->state, ok);
+ }
+ ... header->state is ONCE_READY here, unless the build failed ...
+
+ A zero filled word is ONCE_EMPTY. The first process to call once_begin()
+ takes it and builds; everyone else sleeps on the word (a futex on Linux,
+ a short poll elsewhere) until the builder ends. The taken word holds the
+ builder's pid, so if the builder dies a waiter takes the word over and
+ builds instead: no lock is left held by a dead process. Pids must be
+ comparable, i.e. all processes in the same pid namespace.
+
+ once_ready() only looks, so it works on a read-only mapping.
+
+ once_end(word, 0) puts the word back to ONCE_EMPTY, which makes it a plain
+ robust process-shared lock.
+ */
+
+#define ONCE_EMPTY		0
+#define ONCE_READY		2
+/* taken: (pid << 2) | 1 */
+
+int once_begin(volatile uint32_t *word);
+int once_ready(const volatile uint32_t *word);
+void once_end(volatile uint32_t *word, int ready);
+/* whether process pid still runs, which is what a taken word is checked for */
+int once_alive(uint32_t pid);
+
+#endif
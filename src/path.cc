@@ -0,0 +1,236 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "phash.h"
+#include "path.h"
+
+/*
+ * Reads the step at *p into step and moves *p past it. Returns 1, 0 at the
+ * end of the path, -1 on a syntax error. Only the first step may be a key
+ * without a dot in front.
+ */
+static int next_step(const char *source, const char **p, path_step_t *step, char *error)
+{
+	const char *s = *p, *start;
+	uint64_t index;
+	char quote;
+
+	if (!*s)
+		return 0;
+
+	memset(step, 0, sizeof(*step));
+	step->slot = -1;
+
+	if (*s == '[') {
+		s++;
+		if (*s == '*' && s[1] == ']') {
+			step->type = PATH_WILD;
+			*p = s + 2;
+			return 1;
+		}
+		if (*s == '"' || *s == '\'') {
+			quote = *s++;
+			for (start = s; *s && *s != quote; s++);
+			if (*s != quote || s[1] != ']') {
+				sprintf(error, "%d: Unterminated key", (int) (start - source));
+				return -1;
+			}
+			step->type = PATH_KEY;
+			step->key = start;
+			step->length = s - start;
+			step->hash = phash_hash(step->key, step->length);
+			*p = s + 2;
+			return 1;
+		}
+		for (start = s, index = 0; *s >= '0' && *s <= '9' && index <= 0xFFFFFFFFu; s++)
+			index = index * 10 + (*s - '0');
+		if (s == start || *s != ']' || index > 0xFFFFFFFFu) {
+			sprintf(error, "%d: Expected an index, * or a quoted key", (int) (start - source));
+			return -1;
+		}
+		step->type = PATH_INDEX;
+		step->index = (uint32_t) index;
+		*p = s + 1;
+		return 1;
+	}
+
+	if (*s == '.')
+		s++;
+	else if (s != source) {
+		sprintf(error, "%d: Expected . or [", (int) (s - source));
+		return -1;
+	}
+	for (start = s; *s && *s != '.' && *s != '['; s++);
+	if (s == start) {
+		sprintf(error, "%d: Empty key", (int) (start - source));
+		return -1;
+	}
+	step->type = PATH_KEY;
+	step->key = start;
+	step->length = s - start;
+	step->hash = phash_hash(step->key, step->length);
+	*p = s;
+	return 1;
+}
+
+/*
+ * Whether slot of shape still holds the step's key. The cached pair can
+ * name another shape once the dataset is gone: a rebuild may land at the
+ * same address, so a hit is only taken after this check.
+ */
+static int slot_holds(const path_step_t *step, const jss_header_t *header, const jss_shape_t *shape)
+{
+	jss_string_t *key;
+
+	if (step->slot < 0 || (unsigned int) step->slot >= shape->size || !shape->keys[step->slot])
+		return 0;
+	key = (jss_string_t *) JSS_PTR(header, shape->keys[step->slot]);
+	return key->length == step->length && !memcmp(key->data, step->key, step->length);
+}
+
+static jss_value_t find_key(path_step_t *step, const jss_header_t *header, jss_value_t value)
+{
+	jss_object_t *object;
+	jss_array_t *array;
+	jss_shape_t *shape;
+
+	if (jss_type(value) == JSS_ARRAY) {
+		array = (jss_array_t *) JSS_PTR(header, jss_payload(value));
+		if (step->length == 6 && !memcmp(step->key, "length", 6))
+			return jss_make(JSS_INT, array->length);
+		return JSS_NONE;
+	}
+	if (jss_type(value) != JSS_OBJECT)
+		return JSS_NONE;
+
+	object = (jss_object_t *) JSS_PTR(header, jss_payload(value));
+	shape = jss_object_shape(header, object);
+	if (step->header != header || step->shape != object->shape || !slot_holds(step, header, shape)) {
+		step->slot = jss_shape_find((void *) header, shape, step->hash, step->key, step->length);
+		step->header = header;
+		step->shape = object->shape;
+	}
+	if (step->slot < 0)
+		return JSS_NONE;
+	return object->values[step->slot];
+}
+
+static jss_value_t find_index(const jss_header_t *header, jss_value_t value, uint32_t index)
+{
+	jss_array_t *array;
+	jss_value_t *cell;
+	char key[16];
+	int length;
+
+	if (jss_type(value) == JSS_ARRAY) {
+		array = (jss_array_t *) JSS_PTR(header, jss_payload(value));
+		if (index >= (uint32_t) array->length)
+			return JSS_NONE;
+		return array->values[index];
+	}
+	if (jss_type(value) != JSS_OBJECT)
+		return JSS_NONE;
+
+	/* objects may still use numeric keys, e.g. { "1": ... } */
+	length = sprintf(key, "%u", index);
+	cell = jss_object_lookup((void *) header, (jss_object_t *) JSS_PTR(header, jss_payload(value)), key, length);
+	if (!cell)
+		return JSS_NONE;
+	return *cell;
+}
+
+/* one step from value; 0 if it wanted an index and there was none left */
+static int walk_step(path_step_t *step, const jss_header_t *header, jss_value_t *value,
+						const uint32_t **indexes, int *count, char *error)
+{
+	switch (step->type) {
+	case PATH_KEY:
+		*value = find_key(step, header, *value);
+		return 1;
+	case PATH_INDEX:
+		*value = find_index(header, *value, step->index);
+		return 1;
+	}
+
+	if (!*count) {
+		sprintf(error, "Not enough indexes for [*]");
+		return 0;
+	}
+	*value = find_index(header, *value, **indexes);
+	(*indexes)++;
+	(*count)--;
+	return 1;
+}
+
+path_t* path_compile(const char *source, char *error)
+{
+	path_t *path = NULL;
+	path_step_t step;
+	const char *p;
+	size_t length = strlen(source);
+	int n, count;
+
+	for (;;) {
+		for (p = source, count = 0; (n = next_step(source, &p, &step, error)) > 0; count++);
+		if (n < 0) break;
+
+		path = (path_t *) calloc(1, sizeof(path_t) + count*sizeof(path_step_t) + length + 1);
+		if (!path) {
+			sprintf(error, "Out of memory");
+			break;
+		}
+		/* keys point into the copy */
+		path->source = (char *) (path->steps + count);
+		memcpy(path->source, source, length + 1);
+
+		for (p = path->source; next_step(path->source, &p, &path->steps[path->count], error) > 0; path->count++) {
+			if (path->steps[path->count].type == PATH_WILD)
+				path->wilds++;
+		}
+		return path;
+	}
+
+	free(path);
+	return NULL;
+}
+
+int path_walk(path_t *path, const jss_header_t *header, jss_value_t value,
+				const uint32_t *indexes, int count, jss_value_t *leaf, char *error)
+{
+	int i;
+
+	if (count < path->wilds) {
+		sprintf(error, "Not enough indexes for [*]");
+		return 0;
+	}
+	for (i = 0; i < path->count && value != JSS_NONE; i++)
+		walk_step(&path->steps[i], header, &value, &indexes, &count, error);
+
+	*leaf = value;
+	return 1;
+}
+
+int path_walk_str(const char *source, const jss_header_t *header, jss_value_t value,
+				const uint32_t *indexes, int count, jss_value_t *leaf, char *error)
+{
+	path_step_t step;
+	const char *p = source;
+	int n;
+
+	/* goes on once nothing is left, so a bad path is always an error */
+	while ((n = next_step(source, &p, &step, error)) > 0) {
+		if (!walk_step(&step, header, &value, &indexes, &count, error))
+			return 0;
+	}
+	if (n < 0)
+		return -1;
+
+	*leaf = value;
+	return 1;
+}
+
+void path_del(path_t *path)
+{
+	free(path);
+}
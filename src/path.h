@@ -0,0 +1,62 @@
+#ifndef _PATH_H
+#define _PATH_H
+
+#include <stdint.h>
+#include "jssdata.h"
+
+/**
+ Property paths walked inside a segment, making nothing on the way.
+
+ path_t *path = path_compile("monsters[*].drops[2].itemId", error);
+ uint32_t index = 120;
+ jss_value_t leaf;
+ if (path_walk(path, header, header->root, &index, 1, &leaf, error) > 0)
+     ... leaf, JSS_NONE if some step wasn't there ...
+ path_del(path);
+
+ A path is keys separated by dots and indexes in brackets, a.b[3].c. Keys
+ with dots or brackets in them are quoted, a["x.y"]; [*] takes the next of
+ the indexes the walk is given. "length" of an array is its length, and
+ an index into an object looks up the key in decimal, the way JS does.
+
+ A compiled path hashes its keys once, and every key step remembers its
+ slot in the last shape it met, so rows of one shape skip the lookup.
+ path_walk_str() parses as it walks, for paths used once.
+
+ error is json_error_max bytes.
+ */
+
+#define PATH_KEY		0
+#define PATH_INDEX		1
+#define PATH_WILD		2
+
+typedef struct path_step_t {
+	int type;
+	uint32_t index;				/* PATH_INDEX */
+	const char *key;			/* PATH_KEY, not terminated */
+	unsigned int length;
+	uint64_t hash;				/* phash_hash(key, length) */
+
+	/* slot of key in the last shape met, -1 if it isn't in there */
+	const jss_header_t *header;
+	int64_t shape;
+	int slot;
+} path_step_t;
+
+typedef struct path_t {
+	int count;
+	int wilds;					/* indexes a walk needs */
+	char *source;				/* keys point into it */
+	path_step_t steps[];
+} path_t;
+
+path_t* path_compile(const char *source, char *error);
+/* 1 with *leaf set, 0 if indexes ran short */
+int path_walk(path_t *path, const jss_header_t *header, jss_value_t value,
+				const uint32_t *indexes, int count, jss_value_t *leaf, char *error);
+/* as path_walk(), -1 if source doesn't parse */
+int path_walk_str(const char *source, const jss_header_t *header, jss_value_t value,
+				const uint32_t *indexes, int count, jss_value_t *leaf, char *error);
+void path_del(path_t *path);
+
+#endif
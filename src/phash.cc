@@ -0,0 +1,161 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "bitmap.h"
+#include "hash.h"
+#include "phash.h"
+
+#define PHASH_LAMBDA		4			/* average keys per bucket */
+#define PHASH_MAX_TRIES		(1 << 20)	/* per bucket, before growing the table */
+
+/* hash64() mixes all 64 bits, bucket and slot use the halves separately */
+uint64_t phash_hash(const char *key, size_t length)
+{
+	return hash64(key, length);
+}
+
+/*
+ * Tries displacements for one bucket until all of its keys land on free
+ * slots. On success the slots are taken in used.
+ */
+static int place_bucket(const uint64_t *hashes, const unsigned int *keys, unsigned int cnt,
+						phash_t *ph, unsigned int bucket, bitmap_t *used)
+{
+	unsigned int i, j, slot;
+
+	for (uint32_t d = 0; d < PHASH_MAX_TRIES; d++) {
+		ph->disp[bucket] = d;
+
+		for (i = 0; i < cnt; i++) {
+			slot = phash_slot(hashes[keys[i]], ph->disp, ph->buckets, ph->size);
+			if (bmapset(used, slot))
+				break;
+			ph->slots[keys[i]] = slot;
+		}
+		if (i == cnt)
+			return 1;
+
+		/* roll back the slots taken by this attempt */
+		for (j = 0; j < i; j++)
+			bmapunset(used, ph->slots[keys[j]]);
+	}
+
+	return 0;
+}
+
+phash_t* phash_create(const uint64_t *hashes, unsigned int n)
+{
+	phash_t *ph = NULL;
+	bitmap_t *used = NULL;
+	unsigned int *start = NULL, *keys = NULL, *order = NULL, *hist = NULL;
+	unsigned int i, j, b, cnt, unique, maxlen;
+	int placed = 0;
+
+	for (;;) {
+		ph = (phash_t *) calloc(1, sizeof(phash_t));
+		if (!ph) break;
+
+		ph->buckets = n / PHASH_LAMBDA + 1;
+		ph->disp = (uint32_t *) calloc(ph->buckets, sizeof(uint32_t));
+		ph->slots = (unsigned int *) calloc(n + 1, sizeof(unsigned int));
+		start = (unsigned int *) calloc(ph->buckets + 1, sizeof(unsigned int));
+		keys = (unsigned int *) calloc(n + 1, sizeof(unsigned int));
+		order = (unsigned int *) calloc(ph->buckets, sizeof(unsigned int));
+		if (!ph->disp || !ph->slots || !start || !keys || !order) break;
+
+		/* group keys by bucket (counting sort) */
+		for (i = 0; i < n; i++)
+			start[phash_bucket(hashes[i], ph->buckets) + 1]++;
+		for (b = 0; b < ph->buckets; b++)
+			start[b+1] += start[b];
+		for (i = 0; i < n; i++)
+			keys[start[phash_bucket(hashes[i], ph->buckets)]++] = i;
+		for (b = ph->buckets; b > 0; b--)
+			start[b] = start[b-1];
+		start[0] = 0;
+
+		/* equal hashes can never be separated, keep the first one */
+		unique = n;
+		for (b = 0; b < ph->buckets; b++) {
+			for (i = start[b]; i < start[b+1]; i++) {
+				for (j = start[b]; j < i; j++) {
+					if (hashes[keys[i]] == hashes[keys[j]] && ph->slots[keys[j]] != PHASH_DUPLICATE) {
+						ph->slots[keys[i]] = PHASH_DUPLICATE;
+						unique--;
+						break;
+					}
+				}
+			}
+			/* compact the bucket */
+			for (i = j = start[b]; i < start[b+1]; i++) {
+				if (ph->slots[keys[i]] != PHASH_DUPLICATE)
+					keys[j++] = keys[i];
+			}
+			for (; j < start[b+1]; j++)
+				keys[j] = n;		/* hole, skipped below */
+		}
+
+		/* largest buckets first, they are the hardest to place */
+		for (b = 0, maxlen = 0; b < ph->buckets; b++) {
+			if (start[b+1] - start[b] > maxlen)
+				maxlen = start[b+1] - start[b];
+		}
+		hist = (unsigned int *) calloc(maxlen + 2, sizeof(unsigned int));
+		if (!hist) break;
+		for (b = 0; b < ph->buckets; b++)
+			hist[maxlen - (start[b+1] - start[b]) + 1]++;
+		for (i = 0; i < maxlen; i++)
+			hist[i+1] += hist[i];
+		for (b = 0; b < ph->buckets; b++)
+			order[hist[maxlen - (start[b+1] - start[b])]++] = b;
+		free(hist);
+		hist = NULL;
+
+		ph->size = unique ? unique : 1;
+		for (;;) {
+			used = bmapcreate(ph->size);
+			if (!used) break;
+
+			for (i = 0; i < ph->buckets; i++) {
+				b = order[i];
+				for (cnt = 0; start[b] + cnt < start[b+1] && keys[start[b] + cnt] != n; cnt++);
+				if (!place_bucket(hashes, keys + start[b], cnt, ph, b, used))
+					break;
+			}
+			bmapdel(used);
+			used = NULL;
+
+			if ((placed = i == ph->buckets))
+				break;
+
+			errprint("backing off: n(%u), size(%u)", n, ph->size);
+			ph->size++;
+			memset(ph->disp, 0, ph->buckets * sizeof(uint32_t));
+		}
+		if (!placed) break;
+
+		free(start);
+		free(keys);
+		free(order);
+		return ph;
+	}
+
+	if (used) bmapdel(used);
+	free(start);
+	free(keys);
+	free(order);
+	phash_del(ph);
+
+	return NULL;
+}
+
+void phash_del(phash_t *ph)
+{
+	if (!ph) return;
+
+	free(ph->disp);
+	free(ph->slots);
+	free(ph);
+}
@@ -0,0 +1,47 @@
+#ifndef _PHASH_H
+#define _PHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ Minimal perfect hash for a fixed key set (hash and displace, CHD style).
+ Keys are split into buckets by one part of their hash, and every bucket
+ gets a displacement that moves all of its keys to free slots. A lookup
+ is then one hash, one displacement read and exactly one slot probe.
+
+ phash_t *ph = phash_create(hashes, n);
+ for (i=0; i<n; i++) table[ph->slots[i]] = key[i];
+ memcpy(disp, ph->disp, ph->buckets * sizeof(uint32_t));
+ phash_del(ph);
+
+ slot = phash_slot(phash_hash(key, len), disp, buckets, size);
+ */
+
+typedef struct phash_t {
+	unsigned int size;			/* slots, == n unless the search had to back off */
+	unsigned int buckets;
+	uint32_t *disp;				/* per bucket displacement */
+	unsigned int *slots;		/* slot of every input key */
+} phash_t;
+
+uint64_t phash_hash(const char *key, size_t length);
+
+/* equal hashes must only be passed for equal keys, which are dropped */
+phash_t* phash_create(const uint64_t *hashes, unsigned int n);
+void phash_del(phash_t *ph);
+
+#define PHASH_DUPLICATE		((unsigned int) -1)
+
+static inline unsigned int phash_bucket(uint64_t h, unsigned int buckets)
+{
+	return (unsigned int) (h >> 32) % buckets;
+}
+
+static inline unsigned int phash_slot(uint64_t h, const uint32_t *disp, unsigned int buckets, unsigned int size)
+{
+	uint64_t x = (h ^ ((uint64_t) disp[phash_bucket(h, buckets)] * 0x9E3779B97F4A7C15ULL)) * 0xFF51AFD7ED558CCDULL;
+	return (unsigned int) (x >> 32) % size;
+}
+
+#endif
@@ -0,0 +1,669 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined (_WIN32) || defined (_WIN64)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "error.h"
+#include "hash.h"
+#include "once.h"
+#include "registry.h"
+
+#define ALIGN(n)	(((n) + REGISTRY_ALIGN - 1) & ~((int64_t) REGISTRY_ALIGN - 1))
+
+#define BIT_SET(bits, i)	((bits)[(i) >> 5] |= (uint32_t) 1 << ((i) & 31))
+#define BIT_CLEAR(bits, i)	((bits)[(i) >> 5] &= ~((uint32_t) 1 << ((i) & 31)))
+#define BIT_TEST(bits, i)	((bits)[(i) >> 5] & ((uint32_t) 1 << ((i) & 31)))
+
+static uint32_t self_pid()
+{
+#if defined (_WIN32) || defined (_WIN64)
+	return (uint32_t) GetCurrentProcessId();
+#else
+	return (uint32_t) getpid();
+#endif
+}
+
+/* when pid started, in clock ticks since boot; 0 if that can't be told */
+static uint64_t start_time(uint32_t pid)
+{
+#if defined (__linux__)
+	char path[64], buf[1024], *p;
+	unsigned long long start = 0;
+	FILE *fp;
+	size_t n;
+	int field;
+
+	snprintf(path, sizeof(path), "/proc/%u/stat", pid);
+	fp = fopen(path, "r");
+	if (!fp)
+		return 0;
+	n = fread(buf, 1, sizeof(buf) - 1, fp);
+	fclose(fp);
+	buf[n] = 0;
+
+	/* the command name can hold anything, fields are counted from its ')' */
+	p = strrchr(buf, ')');
+	if (!p)
+		return 0;
+	for (field = 2; *p && field < 22; p++)
+		if (*p == ' ')
+			field++;
+	sscanf(p, "%llu", &start);
+	return start;
+#else
+	(void) pid;
+	return 0;
+#endif
+}
+
+static int no_holders(const uint32_t *holders)
+{
+	int i;
+
+	for (i = 0; i < REGISTRY_HOLDERS; i++)
+		if (holders[i])
+			return 0;
+	return 1;
+}
+
+static uint64_t name_hash(const char *name)
+{
+	return hash64(name, strlen(name)) | 1;
+}
+
+/* slot of name, or the free slot it would go to; -1 if the table is full */
+static int probe(registry_index_t *index, const char *name, uint64_t h)
+{
+	unsigned int i, slot;
+	registry_entry_t *entry;
+
+	for (i = 0; i < REGISTRY_SLOTS; i++) {
+		slot = (unsigned int) (h + i) & (REGISTRY_SLOTS - 1);
+		entry = &index->entries[slot];
+		if (!entry->hash)
+			return (int) slot;
+		if (entry->hash == h && !strncmp(entry->name, name, REGISTRY_NAME_MAX))
+			return (int) slot;
+	}
+	return -1;
+}
+
+/*
+ * Maps region r, creating it at size if it doesn't exist yet. Datasets are
+ * read through a read-only mapping; only building and discarding need the
+ * writable one, which a process that only reads never maps.
+ */
+static shm_t* map_region(registry_t *registry, int r, int64_t size, int writable)
+{
+	shm_t **shm = writable ? &registry->writable[r] : &registry->regions[r];
+	char name[SHM_NAME_MAX];
+
+	if (*shm)
+		return *shm;
+
+	snprintf(name, sizeof(name), "%s.%d", registry->name, r);
+	*shm = shm_create_named(name, size, writable ? SHM_READWRITE : SHM_READONLY);
+	if (!*shm)
+		printf("[registry] can't map %s\n", name);
+	return *shm;
+}
+
+registry_t* registry_open(const char *name)
+{
+	registry_t *registry = NULL;
+	registry_index_t *index;
+
+	if (!name || strlen(name) >= SHM_NAME_MAX - 4)
+		return NULL;
+
+	for (;;) {
+		registry = (registry_t *) calloc(1, sizeof(registry_t));
+		if (!registry) break;
+		registry->lease = -1;
+		snprintf(registry->name, SHM_NAME_MAX, "%s", name);
+
+		registry->index = shm_create_named(name, sizeof(registry_index_t), SHM_READWRITE);
+		if (!registry->index) break;
+
+		/* whoever comes first formats it, a stale index from an older
+		   layout is dropped along with everything it pointed to */
+		registry_lock(registry);
+		index = (registry_index_t *) shm_get(registry->index);
+		if (index->magic != REGISTRY_MAGIC || index->version != REGISTRY_VERSION) {
+			memset(&index->count, 0, sizeof(registry_index_t) - offsetof(registry_index_t, count));
+			index->magic = REGISTRY_MAGIC;
+			index->version = REGISTRY_VERSION;
+		}
+
+		/* a slot left by a dead process is as good as a free one */
+		registry->swept = registry_sweep(registry);
+		for (registry->lease = 0; registry->lease < REGISTRY_LEASES; registry->lease++)
+			if (!index->leases[registry->lease].pid)
+				break;
+		if (registry->lease == REGISTRY_LEASES) {
+			registry_unlock(registry);
+			printf("[registry] %s: all %d leases are taken\n", name, REGISTRY_LEASES);
+			registry->lease = -1;
+			break;
+		}
+		index->leases[registry->lease].pid = self_pid();
+		index->leases[registry->lease].start = start_time(self_pid());
+		index->leases[registry->lease].attached = time(NULL);
+		index->leases[registry->lease].seen = time(NULL);
+		registry_unlock(registry);
+
+		return registry;
+	}
+
+	registry_close(registry);
+	return NULL;
+}
+
+/*
+ * Sleeps while another process holds it, taken over if that one died.
+ * The lock word holds the pid, which can't tell nested calls of this
+ * process apart, so they are counted here: only the outermost unlock
+ * lets go.
+ */
+int registry_lock(registry_t *registry)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+
+	if (registry->depth++)
+		return 1;
+	return once_begin(&index->lock);
+}
+
+int registry_unlock(registry_t *registry)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+
+	if (--registry->depth)
+		return 1;
+	once_end(&index->lock, 0);
+	return 1;
+}
+
+registry_entry_t* registry_lookup(registry_t *registry, const char *name)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	uint64_t h = name_hash(name);
+	int slot = probe(index, name, h);
+
+	if (slot < 0 || !index->entries[slot].hash)
+		return NULL;
+	return &index->entries[slot];
+}
+
+jss_header_t* registry_header(registry_t *registry, int version)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	registry_version_t *v;
+	jss_header_t *header;
+	shm_t *region;
+
+	if (version <= 0 || version >= REGISTRY_VERSIONS)
+		return NULL;
+	v = &index->versions[version];
+	if (!v->size || v->region < 0 || v->region >= index->regions)
+		return NULL;
+
+	/* size 0, the region was created by whoever published into it */
+	region = map_region(registry, v->region, 0, 0);
+	if (!region || v->offset + v->size > region->size)
+		return NULL;
+
+	header = (jss_header_t *) ((unsigned char *) shm_get(region) + v->offset);
+	if (header->magic != JSS_MAGIC || header->version != JSS_VERSION)
+		return NULL;
+	return header;
+}
+
+/* gives size bytes at offset back, merged with the holes next to them */
+static void free_space(registry_t *registry, int region, int64_t offset, int64_t size)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	registry_hole_t *hole;
+	int i;
+
+	/* the pages go back to the system now, not when the space is reused */
+	if (map_region(registry, region, 0, 1))
+		shm_discard(registry->writable[region], offset, size);
+
+	for (i = 0; i < index->holes; ) {
+		hole = &index->hole[i];
+		if (hole->region == region &&
+			(hole->offset + hole->size == offset || offset + size == hole->offset)) {
+			if (hole->offset < offset)
+				offset = hole->offset;
+			size += hole->size;
+			index->hole[i] = index->hole[--index->holes];
+			continue;
+		}
+		i++;
+	}
+
+	if (offset + size == index->region[region].used) {
+		index->region[region].used = offset;
+		return;
+	}
+	if (index->holes == REGISTRY_HOLES) {
+		printf("[registry] %s: too many holes, %lld bytes lost\n", registry->name, (long long) size);
+		return;
+	}
+	hole = &index->hole[index->holes++];
+	hole->region = region;
+	hole->offset = offset;
+	hole->size = size;
+}
+
+/* size bytes at offset, out of the hole starting there or off the region's end */
+static void take_space(registry_index_t *index, int region, int64_t offset, int64_t size)
+{
+	registry_hole_t *hole;
+	int i;
+
+	for (i = 0; i < index->holes; i++) {
+		hole = &index->hole[i];
+		if (hole->region != region || hole->offset != offset)
+			continue;
+		hole->offset += size;
+		hole->size -= size;
+		if (!hole->size)
+			index->hole[i] = index->hole[--index->holes];
+		return;
+	}
+	index->region[region].used = offset + size;
+}
+
+static void reclaim(registry_t *registry, int version)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	registry_version_t *v = &index->versions[version];
+
+	free_space(registry, v->region, v->offset, ALIGN(v->size));
+	memset(v, 0, sizeof(registry_version_t));
+}
+
+/*
+ * The entry of name, made without a version if there is none yet, so a
+ * builder has its build word to take. NULL if the table is full.
+ */
+registry_entry_t* registry_enter(registry_t *registry, const char *name)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	registry_entry_t *entry;
+	uint64_t h = name_hash(name);
+	int slot;
+
+	if (strlen(name) >= REGISTRY_NAME_MAX) {
+		printf("[registry] name too long: %s\n", name);
+		return NULL;
+	}
+
+	slot = probe(index, name, h);
+	if (slot < 0 || (!index->entries[slot].hash && index->count >= REGISTRY_SLOTS * 3 / 4)) {
+		printf("[registry] %s: no free slot for %s\n", registry->name, name);
+		return NULL;
+	}
+
+	entry = &index->entries[slot];
+	if (!entry->hash) {
+		snprintf(entry->name, REGISTRY_NAME_MAX, "%s", name);
+		entry->hash = h;
+		index->count++;
+	}
+	return entry;
+}
+
+/*
+ * Takes room for size bytes, to be built into through the returned pointer
+ * without the lock: the first hole that fits, the end of the last region,
+ * or a new region. The room is a version record that isn't any entry's
+ * yet, held by this process, so it goes back if the process dies before
+ * registry_publish() or registry_cancel().
+ */
+jss_header_t* registry_reserve(registry_t *registry, int64_t size, int *version)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	registry_region_t *last;
+	registry_version_t *v;
+	shm_t *shm = NULL;
+	int64_t offset;
+	int i, r = -1;
+
+	size = ALIGN(size);
+
+	for (*version = 1; *version < REGISTRY_VERSIONS && index->versions[*version].size; (*version)++);
+	if (*version == REGISTRY_VERSIONS) {
+		printf("[registry] %s: no free version\n", registry->name);
+		return NULL;
+	}
+
+	for (i = 0; i < index->holes; i++) {
+		if (index->hole[i].size < size)
+			continue;
+		r = index->hole[i].region;
+		shm = map_region(registry, r, 0, 1);
+		if (!shm)
+			return NULL;
+		offset = index->hole[i].offset;
+		break;
+	}
+
+	if (!shm) {
+		r = index->regions - 1;
+		last = r >= 0 ? &index->region[r] : NULL;
+		if (!last || last->size - last->used < size) {
+			if (index->regions == REGISTRY_REGIONS) {
+				printf("[registry] %s: all %d regions are full\n", registry->name, REGISTRY_REGIONS);
+				return NULL;
+			}
+			r = index->regions;
+			shm = map_region(registry, r, size > REGISTRY_REGION_SIZE ? size : REGISTRY_REGION_SIZE, 1);
+			if (!shm)
+				return NULL;
+			index->region[r].size = shm->size;
+			index->region[r].used = 0;
+			index->regions++;
+		} else {
+			shm = map_region(registry, r, 0, 1);
+			if (!shm)
+				return NULL;
+		}
+		offset = index->region[r].used;
+	}
+
+	take_space(index, r, offset, size);
+
+	v = &index->versions[*version];
+	memset(v, 0, sizeof(registry_version_t));
+	v->region = r;
+	v->offset = offset;
+	v->size = size;
+	v->building = 1;
+	v->created = time(NULL);
+	BIT_SET(v->holders, registry->lease);
+
+	return (jss_header_t *) ((unsigned char *) shm_get(shm) + offset);
+}
+
+/* gives a reservation back */
+void registry_cancel(registry_t *registry, int version)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+
+	if (version > 0 && version < REGISTRY_VERSIONS && index->versions[version].building)
+		reclaim(registry, version);
+}
+
+/*
+ * Makes the reservation version, built up to header->used, the current
+ * version of entry; the room past that goes back. The version it replaces
+ * is reclaimed right away if nobody acquired it. Returns version, 0 on
+ * failure, which leaves the reservation to registry_cancel().
+ */
+int registry_publish(registry_t *registry, registry_entry_t *entry, int version, const jss_header_t *header)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	registry_version_t *v;
+	int64_t used = ALIGN((int64_t) header->used);
+	int old;
+
+	if (!entry || version <= 0 || version >= REGISTRY_VERSIONS)
+		return 0;
+	v = &index->versions[version];
+	if (!v->building || used > v->size)
+		return 0;
+
+	if (used < v->size)
+		free_space(registry, v->region, v->offset + used, v->size - used);
+
+	v->crc = header->lastParsed;
+	v->size = header->used;
+	v->entry = (int) (entry - index->entries);
+	v->building = 0;
+	v->created = time(NULL);
+	v->seen = 0;
+	memset(v->holders, 0, sizeof(v->holders));
+
+	/* the flip, readers see either version whole */
+	old = entry->current;
+	entry->current = version;
+	if (old && no_holders(index->versions[old].holders))
+		reclaim(registry, old);
+
+	return version;
+}
+
+/* the entry's current version for this process, 0 if it has none */
+int registry_acquire(registry_t *registry, registry_entry_t *entry)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	int version;
+
+	if (!entry || !(version = entry->current))
+		return 0;
+
+	if (registry->held[version]++ == 0) {
+		BIT_SET(index->versions[version].holders, registry->lease);
+		index->versions[version].seen = time(NULL);
+		index->leases[registry->lease].seen = time(NULL);
+	}
+	return version;
+}
+
+/*
+ * Takes name away: nobody acquires it any more, and its version goes as
+ * soon as no process holds it. 0 if there was nothing to take.
+ */
+int registry_unpublish(registry_t *registry, registry_entry_t *entry)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	int version;
+
+	if (!entry || !(version = entry->current))
+		return 0;
+
+	entry->current = 0;
+	if (no_holders(index->versions[version].holders))
+		reclaim(registry, version);
+	return 1;
+}
+
+/* one more reference to a version this process already acquired */
+void registry_hold(registry_t *registry, int version)
+{
+	if (version > 0 && version < REGISTRY_VERSIONS)
+		registry->held[version]++;
+}
+
+void registry_release(registry_t *registry, int version)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	registry_version_t *v;
+
+	if (version <= 0 || version >= REGISTRY_VERSIONS || --registry->held[version] > 0)
+		return;
+
+	registry_lock(registry);
+	v = &index->versions[version];
+	BIT_CLEAR(v->holders, registry->lease);
+	if (no_holders(v->holders) && v->size && index->entries[v->entry].current != (uint32_t) version)
+		reclaim(registry, version);
+	registry_unlock(registry);
+}
+
+static registry_segment_t* find_segment(registry_index_t *index, const char *name, unsigned int key)
+{
+	int i;
+
+	for (i = 0; i < REGISTRY_SEGMENTS; i++) {
+		registry_segment_t *segment = &index->segments[i];
+		if (segment->size && segment->key == key && !strncmp(segment->name, name, REGISTRY_NAME_MAX))
+			return segment;
+	}
+	return NULL;
+}
+
+/*
+ * Records that this process maps a segment of its own, by name for a
+ * named one or by key for SysV (name ""). The first to record it is taken
+ * for its builder. 0 if the table is full; the segment works regardless,
+ * it just can't be listed or evicted.
+ */
+int registry_attach_segment(registry_t *registry, const char *name, unsigned int key, int64_t size)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	registry_segment_t *segment;
+	int i;
+
+	if (strlen(name) >= REGISTRY_NAME_MAX)
+		return 0;
+
+	segment = find_segment(index, name, key);
+	if (!segment) {
+		for (i = 0; i < REGISTRY_SEGMENTS && index->segments[i].size; i++);
+		if (i == REGISTRY_SEGMENTS) {
+			printf("[registry] %s: no free segment record for %s/%08x\n", registry->name, name, key);
+			return 0;
+		}
+		segment = &index->segments[i];
+		memset(segment, 0, sizeof(registry_segment_t));
+		snprintf(segment->name, REGISTRY_NAME_MAX, "%s", name);
+		segment->key = key;
+		segment->builder = self_pid();
+		segment->created = time(NULL);
+	}
+	/* it can have shrunk since, the last to attach knows best */
+	segment->size = size > 0 ? size : 1;
+	segment->seen = time(NULL);
+	BIT_SET(segment->holders, registry->lease);
+	index->leases[registry->lease].seen = time(NULL);
+	return 1;
+}
+
+/*
+ * The record forgets this process. Once nobody holds it, it goes: the
+ * last shm_del() removes the segment itself (SHM_TRANSIENT for a named
+ * one), records of crashed holders are left to registry_remove_segment().
+ */
+void registry_detach_segment(registry_t *registry, const char *name, unsigned int key)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	registry_segment_t *segment = find_segment(index, name, key);
+
+	if (!segment)
+		return;
+	BIT_CLEAR(segment->holders, registry->lease);
+	if (no_holders(segment->holders))
+		memset(segment, 0, sizeof(registry_segment_t));
+}
+
+/*
+ * Removes a recorded segment nobody holds: its name or key is taken away,
+ * and its memory goes back once the last mapping is gone, which for an
+ * unheld segment is now. 0 if some process still holds it.
+ */
+int registry_remove_segment(registry_segment_t *segment)
+{
+	shm_t *shm;
+
+	if (!segment->size || !no_holders(segment->holders))
+		return 0;
+
+	/* size 0, only attach; gone already is fine */
+	shm = segment->name[0] ? shm_create_named(segment->name, 0, SHM_READONLY)
+						   : shm_create((int) segment->key, 0, SHM_READONLY);
+	if (shm) {
+		shm_remove(shm);
+		shm_close(shm);
+	}
+	memset(segment, 0, sizeof(registry_segment_t));
+	return 1;
+}
+
+/*
+ * Frees the leases of processes that ended without closing the registry,
+ * and drops them from whatever they held. A pid that runs again under a
+ * different start time is a new process. Returns how many leases went.
+ */
+int registry_sweep(registry_t *registry)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	registry_lease_t *lease;
+	registry_version_t *v;
+	int i, version, swept = 0;
+
+	for (i = 0; i < REGISTRY_LEASES; i++) {
+		lease = &index->leases[i];
+		if (!lease->pid)
+			continue;
+		if (once_alive(lease->pid) && (!lease->start || lease->start == start_time(lease->pid)))
+			continue;
+
+		for (version = 1; version < REGISTRY_VERSIONS; version++) {
+			v = &index->versions[version];
+			if (!v->size || !BIT_TEST(v->holders, i))
+				continue;
+			BIT_CLEAR(v->holders, i);
+			if (no_holders(v->holders) && index->entries[v->entry].current != (uint32_t) version)
+				reclaim(registry, version);
+		}
+		for (version = 0; version < REGISTRY_SEGMENTS; version++)
+			BIT_CLEAR(index->segments[version].holders, i);
+
+		memset(lease, 0, sizeof(registry_lease_t));
+		swept++;
+	}
+	return swept;
+}
+
+int registry_owners(registry_t *registry, const uint32_t *holders, uint32_t *pids, int max)
+{
+	registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+	int i, n = 0;
+
+	for (i = 0; i < REGISTRY_LEASES && n < max; i++)
+		if (BIT_TEST(holders, i) && index->leases[i].pid)
+			pids[n++] = index->leases[i].pid;
+	return n;
+}
+
+void registry_close(registry_t *registry)
+{
+	int r, version;
+
+	if (!registry) return;
+
+	/* whatever this process still holds */
+	if (registry->index && registry->lease >= 0) {
+		registry_index_t *index = (registry_index_t *) shm_get(registry->index);
+
+		for (version = 1; version < REGISTRY_VERSIONS; version++) {
+			if (registry->held[version] > 0) {
+				registry->held[version] = 1;
+				registry_release(registry, version);
+			}
+		}
+
+		registry_lock(registry);
+		for (r = 0; r < REGISTRY_SEGMENTS; r++)
+			BIT_CLEAR(index->segments[r].holders, registry->lease);
+		memset(&index->leases[registry->lease], 0, sizeof(registry_lease_t));
+		registry_unlock(registry);
+	}
+
+	for (r = 0; r < REGISTRY_REGIONS; r++) {
+		if (registry->regions[r]) shm_del(registry->regions[r]);
+		if (registry->writable[r]) shm_del(registry->writable[r]);
+	}
+	if (registry->index) shm_del(registry->index);
+	free(registry);
+}
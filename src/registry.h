@@ -0,0 +1,175 @@
+#ifndef _REGISTRY_H
+#define _REGISTRY_H
+
+#include <stdint.h>
+#include "shm.h"
+#include "jssdata.h"
+
+/**
+ Many datasets in a few large shared regions, found by name.
+
+ registry_t *registry = registry_open("/jss.registry");
+
+ registry_lock(registry);
+ registry_entry_t *entry = registry_enter(registry, "items");
+ jss_header_t *header = registry_reserve(registry, size, &version);
+ registry_unlock(registry);
+ ... build into header without the lock, set header->used ...
+ registry_lock(registry);
+ registry_publish(registry, entry, version, header);
+ registry_unlock(registry);
+
+ registry_lock(registry);
+ int version = registry_acquire(registry, registry_lookup(registry, "items"));
+ registry_unlock(registry);
+ jss_header_t *header = registry_header(registry, version);
+ ...
+ registry_release(registry, version);
+ registry_close(registry);
+
+ The index is one small named segment: a fixed open addressing table of
+ entries keyed by hash64(name), so a lookup is a probe or two. Datasets are
+ packed into regions named "<name>.0", "<name>.1", ... which are created
+ sparse, so untouched pages cost nothing. A process maps the index and
+ each region once, however many datasets it opens. Regions are mapped
+ read-only unless the process builds into them; the index stays writable,
+ it holds the lock and the reader counts.
+
+ Every publish is a new version in space of its own, reserved and built
+ without the lock, so readers only ever wait for the publish itself; the
+ entry's current version id is then flipped with one store. Builders of
+ the same name take turns on the entry's build word. Whoever acquired the old
+ version keeps reading it, and its space goes back to the registry when
+ the last process releases it. Within a process acquire/release only
+ count, the shared holders bitmap changes once per process.
+
+ Every process that opens the registry takes a lease: its pid and start
+ time. Versions, and the standalone segments recorded with
+ registry_attach_segment(), know their holders by lease. registry_sweep()
+ frees the leases of processes that are gone along with whatever they
+ held, so a crash leaks nothing for longer than until the next sweep;
+ registry_open() sweeps, keeping the count in registry->swept, and so
+ does "jssadm sweep".
+ */
+
+#define REGISTRY_MAGIC			0x5F4A5352	/* '_JSR' as gcc reads it */
+#define REGISTRY_VERSION		4
+
+#define REGISTRY_NAME_MAX		64
+#define REGISTRY_SLOTS			4096				/* power of 2 */
+#define REGISTRY_VERSIONS		(REGISTRY_SLOTS * 2)
+#define REGISTRY_HOLES			256
+#define REGISTRY_LEASES			512					/* processes at once */
+#define REGISTRY_SEGMENTS		1024
+#define REGISTRY_REGIONS		16
+#define REGISTRY_REGION_SIZE	((int64_t) 1 << 30)	/* sparse, see above */
+#define REGISTRY_ALIGN			4096				/* datasets start on a page */
+
+typedef struct registry_entry_t {
+	uint64_t hash;				/* hash64(name) | 1, 0 for a free slot */
+	volatile uint32_t current;	/* version id, 0 for none */
+	volatile uint32_t build;	/* once.h word, taken by whoever builds the next version */
+	char name[REGISTRY_NAME_MAX];
+} registry_entry_t;
+
+typedef struct registry_lease_t {
+	uint32_t pid;				/* 0 for a free lease */
+	unsigned int reserved;
+	uint64_t start;				/* process start time, tells a reused pid apart */
+	int64_t attached;			/* time() it opened the registry */
+	int64_t seen;				/* time() of its last acquire or attach */
+} registry_lease_t;
+
+/* one bit per lease */
+#define REGISTRY_HOLDERS		(REGISTRY_LEASES / 32)
+
+typedef struct registry_version_t {
+	int region;
+	unsigned int crc;			/* header->lastParsed of the dataset */
+	int64_t offset;				/* of its jss_header_t from the region start */
+	int64_t size;				/* header->used, 0 for a free record */
+	int entry;					/* slot of the entry it belongs to */
+	unsigned int building;		/* reserved, not published yet; entry means nothing */
+	int64_t created;
+	int64_t seen;				/* last acquired */
+	uint32_t holders[REGISTRY_HOLDERS];
+} registry_version_t;
+
+/* a segment of its own (shm.h), recorded to be listed and evicted */
+typedef struct registry_segment_t {
+	char name[REGISTRY_NAME_MAX];	/* shm_create_named() name, "" for SysV */
+	unsigned int key;				/* SysV key */
+	uint32_t builder;				/* pid */
+	int64_t size;					/* 0 for a free record */
+	int64_t created;
+	int64_t seen;					/* last attached */
+	uint32_t holders[REGISTRY_HOLDERS];
+} registry_segment_t;
+
+/* unused space between datasets, left by released versions */
+typedef struct registry_hole_t {
+	int region;
+	int64_t offset;
+	int64_t size;
+} registry_hole_t;
+
+typedef struct registry_region_t {
+	int64_t size;
+	int64_t used;
+} registry_region_t;
+
+/* the shared index segment */
+typedef struct registry_index_t {
+	unsigned int magic;
+	unsigned int version;
+	volatile uint32_t lock;		/* once.h word, never made ONCE_READY */
+	unsigned int count;
+	int regions;
+	int holes;
+	registry_region_t region[REGISTRY_REGIONS];
+	registry_hole_t hole[REGISTRY_HOLES];
+	registry_lease_t leases[REGISTRY_LEASES];
+	registry_entry_t entries[REGISTRY_SLOTS];
+	registry_version_t versions[REGISTRY_VERSIONS];
+	registry_segment_t segments[REGISTRY_SEGMENTS];
+} registry_index_t;
+
+/* a process' view of it */
+typedef struct registry_t {
+	char name[SHM_NAME_MAX];
+	shm_t *index;
+	shm_t *regions[REGISTRY_REGIONS];		/* read-only */
+	shm_t *writable[REGISTRY_REGIONS];		/* for builds, mapped on demand */
+	int lease;
+	int depth;							/* registry_lock() calls not yet unlocked */
+	int swept;							/* leases registry_open() swept */
+	int held[REGISTRY_VERSIONS];		/* acquire counts of this process */
+} registry_t;
+
+/* one per process and registry, the lock is held by process */
+registry_t* registry_open(const char *name);
+int registry_lock(registry_t *registry);
+int registry_unlock(registry_t *registry);
+registry_entry_t* registry_lookup(registry_t *registry, const char *name);
+/* version id an entry points at now, no lock needed */
+#define registry_current(entry)		((int) (entry)->current)
+jss_header_t* registry_header(registry_t *registry, int version);
+/* the following need the lock */
+registry_entry_t* registry_enter(registry_t *registry, const char *name);
+jss_header_t* registry_reserve(registry_t *registry, int64_t size, int *version);
+void registry_cancel(registry_t *registry, int version);
+int registry_publish(registry_t *registry, registry_entry_t *entry, int version, const jss_header_t *header);
+int registry_acquire(registry_t *registry, registry_entry_t *entry);
+int registry_unpublish(registry_t *registry, registry_entry_t *entry);
+int registry_attach_segment(registry_t *registry, const char *name, unsigned int key, int64_t size);
+void registry_detach_segment(registry_t *registry, const char *name, unsigned int key);
+int registry_remove_segment(registry_segment_t *segment);
+int registry_sweep(registry_t *registry);
+/* pids of the leases in holders, at most max of them; returns how many */
+int registry_owners(registry_t *registry, const uint32_t *holders, uint32_t *pids, int max);
+/* these don't, release takes the lock itself if it has to */
+void registry_hold(registry_t *registry, int version);
+void registry_release(registry_t *registry, int version);
+void registry_close(registry_t *registry);
+
+#endif
@@ -0,0 +1,466 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "error.h"
+#include "sax.h"
+
+/*
+ * Same grammar as json_parse() (udp/json-parser) but in a single pass:
+ * values are reported to the handler as soon as they are complete, so the
+ * caller never needs the whole document as a tree. Escapes are decoded
+ * into a scratch buffer, unescaped strings are handed out in place.
+ */
+
+enum {
+	SAX_VALUE,				/* any value */
+	SAX_VALUE_OR_END,		/* right after '[' */
+	SAX_KEY,				/* after ',' in an object */
+	SAX_KEY_OR_END,			/* right after '{' */
+	SAX_COLON,
+	SAX_NEXT,				/* ',' or the closing bracket */
+	SAX_DONE
+};
+
+typedef struct sax_state_t {
+	const char *p;
+	const char *end;
+	unsigned int line;
+	const char *line_begin;
+
+	char *scratch;			/* decoded strings and number tokens */
+	unsigned int scratch_size;
+
+	unsigned char *stack;	/* '{' or '[' per open container */
+	unsigned int depth;
+	unsigned int stack_size;
+
+	char *error;
+} sax_state_t;
+
+#define sax_col(st)		((int) ((st)->p - (st)->line_begin))
+
+static unsigned char hex_value(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return 0xFF;
+}
+
+static int reserve(sax_state_t *st, unsigned int size)
+{
+	char *p;
+	unsigned int n;
+
+	if (size <= st->scratch_size)
+		return 1;
+
+	for (n = st->scratch_size ? st->scratch_size : 256; n < size; n <<= 1);
+	p = (char *) realloc(st->scratch, n);
+	if (!p) {
+		sprintf(st->error, "%d:%d: Out of memory", st->line, sax_col(st));
+		return 0;
+	}
+	st->scratch = p;
+	st->scratch_size = n;
+	return 1;
+}
+
+static int push(sax_state_t *st, unsigned char type)
+{
+	unsigned char *p;
+	unsigned int n;
+
+	if (st->depth == st->stack_size) {
+		n = st->stack_size ? st->stack_size << 1 : 64;
+		p = (unsigned char *) realloc(st->stack, n);
+		if (!p) {
+			sprintf(st->error, "%d:%d: Out of memory", st->line, sax_col(st));
+			return 0;
+		}
+		st->stack = p;
+		st->stack_size = n;
+	}
+	st->stack[st->depth++] = type;
+	return 1;
+}
+
+static void skip_whitespace(sax_state_t *st)
+{
+	for (; st->p < st->end; st->p++) {
+		switch (*st->p) {
+		case '\n':
+			st->line++;
+			st->line_begin = st->p;
+			/* fall through */
+		case ' ': case '\t': case '\r':
+			continue;
+		}
+		break;
+	}
+}
+
+static unsigned int utf8_encode(char *out, unsigned int uchar)
+{
+	if (uchar <= 0x7F) {
+		out[0] = (char) uchar;
+		return 1;
+	}
+	if (uchar <= 0x7FF) {
+		out[0] = 0xC0 | (uchar >> 6);
+		out[1] = 0x80 | (uchar & 0x3F);
+		return 2;
+	}
+	if (uchar <= 0xFFFF) {
+		out[0] = 0xE0 | (uchar >> 12);
+		out[1] = 0x80 | ((uchar >> 6) & 0x3F);
+		out[2] = 0x80 | (uchar & 0x3F);
+		return 3;
+	}
+	out[0] = 0xF0 | (uchar >> 18);
+	out[1] = 0x80 | ((uchar >> 12) & 0x3F);
+	out[2] = 0x80 | ((uchar >> 6) & 0x3F);
+	out[3] = 0x80 | (uchar & 0x3F);
+	return 4;
+}
+
+static int read_hex4(sax_state_t *st, unsigned int *uchar)
+{
+	unsigned char b1, b2, b3, b4;
+
+	if (st->end - st->p < 5 ||
+		(b1 = hex_value(st->p[1])) == 0xFF || (b2 = hex_value(st->p[2])) == 0xFF ||
+		(b3 = hex_value(st->p[3])) == 0xFF || (b4 = hex_value(st->p[4])) == 0xFF)
+	{
+		sprintf(st->error, "%d:%d: Invalid character value `%c`", st->line, sax_col(st), *st->p);
+		return 0;
+	}
+	*uchar = (b1 << 12) | (b2 << 8) | (b3 << 4) | b4;
+	st->p += 4;
+	return 1;
+}
+
+/*
+ * st->p is on the opening quote; on return it is past the closing one.
+ */
+static int read_string(sax_state_t *st, const char **str, unsigned int *length)
+{
+	const char *start = ++st->p, *s;
+	unsigned int len, uchar, uchar2;
+
+	/* fast path, no escapes: hand out the input itself */
+	for (s = start; s < st->end && *s != '"' && *s != '\\' && (unsigned char) *s >= 0x20; s++);
+	if (s == st->end) {
+		sprintf(st->error, "%d:%d: Unexpected EOF in string", st->line, sax_col(st));
+		return 0;
+	}
+	if ((unsigned char) *s < 0x20) {
+		st->p = s;
+		sprintf(st->error, "%d:%d: Unexpected control character 0x%02x in string", st->line, sax_col(st), *s);
+		return 0;
+	}
+	if (*s == '"') {
+		*str = start;
+		*length = s - start;
+		st->p = s + 1;
+		return 1;
+	}
+
+	len = s - start;
+	if (!reserve(st, len + 64))
+		return 0;
+	memcpy(st->scratch, start, len);
+
+	for (st->p = s; ; st->p++) {
+		if (st->p == st->end) {
+			sprintf(st->error, "%d:%d: Unexpected EOF in string", st->line, sax_col(st));
+			return 0;
+		}
+		if (!reserve(st, len + 8))
+			return 0;
+
+		if (*st->p == '"')
+			break;
+
+		if ((unsigned char) *st->p < 0x20) {
+			sprintf(st->error, "%d:%d: Unexpected control character 0x%02x in string", st->line, sax_col(st), *st->p);
+			return 0;
+		}
+		if (*st->p != '\\') {
+			st->scratch[len++] = *st->p;
+			continue;
+		}
+
+		if (++st->p == st->end) {
+			sprintf(st->error, "%d:%d: Unexpected EOF in string", st->line, sax_col(st));
+			return 0;
+		}
+
+		switch (*st->p) {
+		case 'b': st->scratch[len++] = '\b'; break;
+		case 'f': st->scratch[len++] = '\f'; break;
+		case 'n': st->scratch[len++] = '\n'; break;
+		case 'r': st->scratch[len++] = '\r'; break;
+		case 't': st->scratch[len++] = '\t'; break;
+		case 'u':
+			if (!read_hex4(st, &uchar))
+				return 0;
+
+			if ((uchar & 0xF800) == 0xD800) {
+				/* a high surrogate, and only a low one after it */
+				if (uchar >= 0xDC00 || st->end - st->p < 3 || st->p[1] != '\\' || st->p[2] != 'u') {
+					sprintf(st->error, "%d:%d: Invalid character value `%c`", st->line, sax_col(st), *st->p);
+					return 0;
+				}
+				st->p += 2;
+				if (!read_hex4(st, &uchar2))
+					return 0;
+				if ((uchar2 & 0xFC00) != 0xDC00) {
+					sprintf(st->error, "%d:%d: Invalid character value `%c`", st->line, sax_col(st), *st->p);
+					return 0;
+				}
+				uchar = 0x010000 | ((uchar & 0x3FF) << 10) | (uchar2 & 0x3FF);
+			}
+			len += utf8_encode(st->scratch + len, uchar);
+			break;
+		default:
+			st->scratch[len++] = *st->p;
+		}
+	}
+
+	*str = st->scratch;
+	*length = len;
+	st->p++;
+	return 1;
+}
+
+static int read_number(sax_state_t *st, sax_handler_t *h)
+{
+	const char *s = st->p;
+	unsigned int len;
+	int is_double = 0;
+	json_int_t integer;
+	double dbl;
+
+	if (s < st->end && *s == '-') s++;
+
+	if (s == st->end || *s < '0' || *s > '9') {
+		sprintf(st->error, "%d:%d: Expected digit", st->line, sax_col(st));
+		return 0;
+	}
+	if (*s == '0' && s+1 < st->end && s[1] >= '0' && s[1] <= '9') {
+		sprintf(st->error, "%d:%d: Unexpected `0` before `%c`", st->line, sax_col(st), s[1]);
+		return 0;
+	}
+	for (; s < st->end && *s >= '0' && *s <= '9'; s++);
+
+	if (s < st->end && *s == '.') {
+		is_double = 1;
+		if (++s == st->end || *s < '0' || *s > '9') {
+			sprintf(st->error, "%d:%d: Expected digit after `.`", st->line, sax_col(st));
+			return 0;
+		}
+		for (; s < st->end && *s >= '0' && *s <= '9'; s++);
+	}
+
+	if (s < st->end && (*s == 'e' || *s == 'E')) {
+		is_double = 1;
+		if (++s < st->end && (*s == '+' || *s == '-')) s++;
+		if (s == st->end || *s < '0' || *s > '9') {
+			sprintf(st->error, "%d:%d: Expected digit after `e`", st->line, sax_col(st));
+			return 0;
+		}
+		for (; s < st->end && *s >= '0' && *s <= '9'; s++);
+	}
+
+	/* the input is not required to be NUL terminated */
+	len = s - st->p;
+	if (!reserve(st, len + 1))
+		return 0;
+	memcpy(st->scratch, st->p, len);
+	st->scratch[len] = '\0';
+	st->p = s;
+
+	if (!is_double) {
+		errno = 0;
+		integer = strtoll(st->scratch, NULL, 10);
+		if (errno != ERANGE)
+			return !h->integer || h->integer(h->userdata, integer);
+	}
+
+	dbl = strtod(st->scratch, NULL);
+	return !h->dbl || h->dbl(h->userdata, dbl);
+}
+
+static int read_literal(sax_state_t *st, const char *literal)
+{
+	size_t len = strlen(literal);
+
+	if ((size_t) (st->end - st->p) < len || memcmp(st->p, literal, len)) {
+		sprintf(st->error, "%d:%d: Unknown value", st->line, sax_col(st));
+		return 0;
+	}
+	st->p += len;
+	return 1;
+}
+
+#define sax_emit(cb, ...) \
+	if (h->cb && !h->cb(h->userdata, ##__VA_ARGS__)) { \
+		sprintf(st.error, "%d:%d: Aborted by handler", st.line, sax_col(&st)); \
+		goto failed; \
+	}
+
+int sax_parse(sax_handler_t *h, const char *json, size_t length, char *error)
+{
+	sax_state_t st;
+	const char *str;
+	unsigned int len;
+	int state = SAX_VALUE;
+	char b;
+
+	/* Skip UTF-8 BOM */
+	if (length >= 3 && ((unsigned char) json[0]) == 0xEF
+					&& ((unsigned char) json[1]) == 0xBB
+					&& ((unsigned char) json[2]) == 0xBF)
+	{
+		json += 3;
+		length -= 3;
+	}
+
+	memset(&st, 0, sizeof(st));
+	st.p = st.line_begin = json;
+	st.end = json + length;
+	st.line = 1;
+	st.error = error;
+	error[0] = '\0';
+
+	for (;;) {
+		skip_whitespace(&st);
+
+		if (st.p == st.end) {
+			if (state == SAX_DONE)
+				break;
+			sprintf(error, "%d:%d: EOF unexpected", st.line, sax_col(&st));
+			goto failed;
+		}
+		b = *st.p;
+
+		switch (state) {
+		case SAX_DONE:
+			sprintf(error, "%d:%d: Trailing garbage: `%c`", st.line, sax_col(&st), b);
+			goto failed;
+
+		case SAX_COLON:
+			if (b != ':') {
+				sprintf(error, "%d:%d: Expected : before %c", st.line, sax_col(&st), b);
+				goto failed;
+			}
+			st.p++;
+			state = SAX_VALUE;
+			continue;
+
+		case SAX_NEXT:
+			if (b == ',') {
+				st.p++;
+				state = st.stack[st.depth-1] == '{' ? SAX_KEY : SAX_VALUE;
+				continue;
+			}
+			if (b == (st.stack[st.depth-1] == '{' ? '}' : ']'))
+				break;	/* closed below */
+
+			sprintf(error, "%d:%d: Expected , before %c", st.line, sax_col(&st), b);
+			goto failed;
+
+		case SAX_KEY_OR_END:
+			if (b == '}')
+				break;
+			/* fall through */
+		case SAX_KEY:
+			if (b != '"') {
+				sprintf(error, "%d:%d: Unexpected `%c` in object", st.line, sax_col(&st), b);
+				goto failed;
+			}
+			if (!read_string(&st, &str, &len))
+				goto failed;
+			sax_emit(object_key, str, len);
+			state = SAX_COLON;
+			continue;
+
+		case SAX_VALUE_OR_END:
+			if (b == ']')
+				break;
+			/* fall through */
+		case SAX_VALUE:
+			switch (b) {
+			case '{':
+				st.p++;
+				if (!push(&st, '{'))
+					goto failed;
+				sax_emit(begin_object);
+				state = SAX_KEY_OR_END;
+				continue;
+			case '[':
+				st.p++;
+				if (!push(&st, '['))
+					goto failed;
+				sax_emit(begin_array);
+				state = SAX_VALUE_OR_END;
+				continue;
+			case '"':
+				if (!read_string(&st, &str, &len))
+					goto failed;
+				sax_emit(string, str, len);
+				break;
+			case 't':
+				if (!read_literal(&st, "true"))
+					goto failed;
+				sax_emit(boolean, 1);
+				break;
+			case 'f':
+				if (!read_literal(&st, "false"))
+					goto failed;
+				sax_emit(boolean, 0);
+				break;
+			case 'n':
+				if (!read_literal(&st, "null"))
+					goto failed;
+				sax_emit(null);
+				break;
+			default:
+				if (b == '-' || (b >= '0' && b <= '9')) {
+					if (!read_number(&st, h)) {
+						if (!error[0])
+							sprintf(error, "%d:%d: Aborted by handler", st.line, sax_col(&st));
+						goto failed;
+					}
+					break;
+				}
+				sprintf(error, "%d:%d: Unexpected %c when seeking value", st.line, sax_col(&st), b);
+				goto failed;
+			}
+			state = st.depth ? SAX_NEXT : SAX_DONE;
+			continue;
+		}
+
+		/* closing bracket of the innermost container */
+		st.p++;
+		if (st.stack[--st.depth] == '{') {
+			sax_emit(end_object);
+		} else {
+			sax_emit(end_array);
+		}
+		state = st.depth ? SAX_NEXT : SAX_DONE;
+	}
+
+	free(st.scratch);
+	free(st.stack);
+	return 1;
+
+failed:
+	errprint("%s", error);
+	free(st.scratch);
+	free(st.stack);
+	return 0;
+}
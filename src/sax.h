@@ -0,0 +1,38 @@
+#ifndef _SAX_H
+#define _SAX_H
+
+#include "json.h"
+
+/**
+ Single pass, event driven JSON reader. Unlike json_parse() it never builds
+ a json_value tree, the handler decides where every value goes.
+
+ sax_handler_t handler = { 0 };
+ handler.string = on_string;
+ handler.userdata = ctx;
+ if (!sax_parse(&handler, json, length, error))
+     printf("%s\n", error);
+
+ Every callback returns non-zero to continue. String and key buffers are
+ only valid during the callback and are not NUL terminated.
+ */
+
+typedef struct sax_handler_t {
+	int (*begin_object)(void *userdata);
+	int (*object_key)(void *userdata, const char *key, unsigned int length);
+	int (*end_object)(void *userdata);
+	int (*begin_array)(void *userdata);
+	int (*end_array)(void *userdata);
+	int (*string)(void *userdata, const char *str, unsigned int length);
+	int (*integer)(void *userdata, json_int_t value);
+	int (*dbl)(void *userdata, double value);
+	int (*boolean)(void *userdata, int value);
+	int (*null)(void *userdata);
+
+	void *userdata;
+} sax_handler_t;
+
+/* error must hold json_error_max bytes */
+int sax_parse(sax_handler_t *handler, const char *json, size_t length, char *error);
+
+#endif
@@ -1,3 +1,10 @@
+#ifndef _SEMA_H
+#define _SEMA_H
+
+#if !defined (_WIN32) && !defined (_WIN64)
+#include <semaphore.h>
+#endif
+
 #if defined (_WIN32) || defined (_WIN64)
 typedef HANDLE	sema_t;
 #else
@@ -14,3 +21,4 @@ int sema_enter(sema_t sema);
 int sema_leave(sema_t sema);
 void sema_del(sema_t sema);
 
+#endif
@@ -5,6 +5,11 @@
 #else
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
 #include <signal.h> 
 #include <unistd.h>
 #include <string.h>
@@ -21,6 +26,7 @@
 #define MAX_OPENED_HISTORY	64
 
 static shmid_t _opened_shmids[MAX_OPENED_HISTORY];
+static shm_t *_opened_named[MAX_OPENED_HISTORY];		/* SHM_TRANSIENT ones */
 static struct sigaction _old_segv_sa;
 static struct sigaction _old_int_sa;
 
@@ -39,6 +45,10 @@ static void cleanup(int sig, siginfo_t *si, void *unused)
 			shmctl(shmid, IPC_RMID, 0);
 
 	}
+	for (int i=0; i < MAX_OPENED_HISTORY; i++) {
+		if (_opened_named[i] && flock(_opened_named[i]->fd, LOCK_EX|LOCK_NB) == 0)
+			shm_remove(_opened_named[i]);
+	}
 
 	if (sig == SIGSEGV && _old_segv_sa.sa_sigaction) {
 		_old_segv_sa.sa_sigaction(sig, si, unused);
@@ -48,6 +58,16 @@ static void cleanup(int sig, siginfo_t *si, void *unused)
 	}
 }
 
+static void forget_named(shm_t *shm)
+{
+	for (int i=0; i < MAX_OPENED_HISTORY; i++) {
+		if (_opened_named[i] == shm) {
+			_opened_named[i] = NULL;
+			break;
+		}
+	}
+}
+
 static void set_shm_cleanup() 
 {
 	static int setted = 0;
@@ -111,6 +131,7 @@ shm_t* shm_create(int key, shm_size_t size, int opt)
 		shm->size = size;
 		shm->at = at;
 		shm->key = key;
+		shm->fd = -1;
 		
 		return shm;
 	}
@@ -123,22 +144,35 @@ shm_t* shm_create(int key, shm_size_t size, int opt)
 	set_shm_cleanup();
 
 	for (;;) {
-		shmid = shmget((key_t)key, size, IPC_CREAT|0666);
+		/* size 0 attaches an existing segment only */
+		opt2 = size ? IPC_CREAT|0666 : 0;
+#ifdef SHM_HUGETLB
+		if (opt & SHM_HUGEPAGE) opt2 |= SHM_HUGETLB;
+#endif
+		shmid = shmget((key_t)key, size, opt2);
 		if (shmid == -1) {
-			printf("shmget error %d\n", errno);
+			if (size || errno != ENOENT)
+				printf("shmget error %d\n", errno);
 			break;
 		}
 		
 		shm = (shm_t*) calloc(1, sizeof(shm_t));
 		if (!shm) break;
 
-		at = shmat(shmid, (void *) 0, 0);
+		at = shmat(shmid, (void *) 0, opt & SHM_RDONLY);
 		if (at == (void *) -1) break;
+
+		if (!size) {
+			struct shmid_ds shminfo;
+			if (shmctl(shmid, IPC_STAT, &shminfo) == 0)
+				size = shminfo.shm_segsz;
+		}
 	
 		shm->shmid = shmid;
 		shm->size = size;
 		shm->at = at;
 		shm->key = key;
+		shm->fd = -1;
 
 		/* for cleanup on abnormal termination */
 		for (int i=0; i < MAX_OPENED_HISTORY; i++) {
@@ -151,7 +185,7 @@ shm_t* shm_create(int key, shm_size_t size, int opt)
 		return shm;
 	}
 
-	if (shmid) close(shmid);
+	/* a shmid is not a descriptor, there is nothing to close */
 #endif
 
 	if (shm) free(shm);
@@ -159,12 +193,392 @@ shm_t* shm_create(int key, shm_size_t size, int opt)
 	return NULL;
 }
 
+#if !defined (_WIN32) && !defined (_WIN64)
+/* anonymous segment, huge pages if the kernel has some reserved */
+static int open_memfd(int opt)
+{
+#if defined (SYS_memfd_create)
+	int fd = -1;
+
+#if defined (MFD_HUGETLB)
+	if (opt & SHM_HUGEPAGE)
+		fd = syscall(SYS_memfd_create, "jss", MFD_HUGETLB);
+#endif
+	if (fd < 0)
+		fd = syscall(SYS_memfd_create, "jss", 0);
+	return fd;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+#endif
+
+shm_t* shm_create_named(const char *name, shm_size_t size, int opt)
+{
+	shm_t *shm = NULL;
+	void *at = NULL;
+
+#if defined (_WIN32) || defined (_WIN64)
+	if (!name) return NULL;
+	for (;;) {
+		shm = (shm_t*) calloc(1, sizeof(shm_t));
+		if (!shm) break;
+
+		_snprintf(shm->name, SHM_NAME_MAX, "Local\\jss%s", name);
+		shm->shmid = CreateFileMappingA(
+			INVALID_HANDLE_VALUE,
+			NULL,
+			(opt & SHM_READWRITE) ? PAGE_READWRITE : PAGE_READONLY,
+			DWORD(size >> 32),
+			DWORD(size),
+			shm->name);
+		if (!shm->shmid) {
+			printf("CreateFileMapping() failure. (%d)\n", GetLastError());
+			break;
+		}
+
+		at = (void*) MapViewOfFile(shm->shmid, opt & (SHM_READWRITE|SHM_READONLY), 0, 0, 0);
+		if (!at) {
+			printf("MapViewOfFile() failure. (%d)\n", GetLastError());
+			break;
+		}
+
+		shm->size = size;
+		shm->at = at;
+		shm->fd = -1;
+
+		return shm;
+	}
+
+	if (shm && shm->shmid) CloseHandle(shm->shmid);
+
+#else
+	struct stat st;
+	int readonly = opt & SHM_READONLY;
+	int oflag = readonly || !size ? (readonly ? O_RDONLY : O_RDWR) : O_RDWR|O_CREAT;
+	int prot = readonly ? PROT_READ : PROT_READ|PROT_WRITE;
+	shm_size_t hugesize = 2*1024*1024;
+
+	/* hugetlb mappings must be a whole number of huge pages */
+	if (opt & SHM_HUGEPAGE)
+		size = (size + hugesize - 1) & ~((shm_size_t) hugesize - 1);
+
+	for (;;) {
+		shm = (shm_t*) calloc(1, sizeof(shm_t));
+		if (!shm) break;
+		shm->fd = -1;
+
+		if (!name) {
+			shm->fd = open_memfd(opt);
+		} else if (strchr(name + 1, '/')) {
+			/* a path, hugetlbfs files are huge page backed by themselves */
+			snprintf(shm->name, SHM_NAME_MAX, "%s", name);
+			shm->fd = open(name, oflag, 0666);
+		} else {
+			snprintf(shm->name, SHM_NAME_MAX, "%s", name);
+			shm->fd = shm_open(name, oflag, 0666);
+		}
+		if (shm->fd < 0) {
+			if (size || errno != ENOENT)
+				printf("shm_open(%s) error %d\n", name ? name : "memfd", errno);
+			break;
+		}
+
+		if (fstat(shm->fd, &st) < 0 || (!size && !st.st_size)) break;
+		if (st.st_size < size) {
+			if (readonly) {
+				printf("shm(%s) is smaller than %lld bytes\n", name, (long long) size);
+				break;
+			}
+			if (ftruncate(shm->fd, size) < 0) {
+				printf("ftruncate(%s, %lld) error %d\n", name, (long long) size, errno);
+				break;
+			}
+		} else {
+			size = st.st_size;
+		}
+
+		at = mmap(NULL, size, prot, MAP_SHARED, shm->fd, 0);
+		if (at == MAP_FAILED) {
+			at = NULL;
+			printf("mmap(%s, %lld) error %d\n", name, (long long) size, errno);
+			break;
+		}
+
+#if defined (MADV_HUGEPAGE)
+		/* transparent huge pages for tmpfs, needs shmem_enabled=advise */
+		if (opt & SHM_HUGEPAGE)
+			madvise(at, size, MADV_HUGEPAGE);
+#endif
+
+		shm->size = size;
+		shm->at = at;
+
+		/* counted by the shared lock, see shm_del() */
+		if ((opt & SHM_TRANSIENT) && shm->name[0] && flock(shm->fd, LOCK_SH) == 0) {
+			shm->transient = 1;
+			for (int i=0; i < MAX_OPENED_HISTORY; i++) {
+				if (!_opened_named[i]) {
+					_opened_named[i] = shm;
+					break;
+				}
+			}
+			set_shm_cleanup();
+		}
+
+		return shm;
+	}
+
+	if (shm && shm->fd >= 0) close(shm->fd);
+#endif
+
+	if (shm) free(shm);
+
+	return NULL;
+}
+
+/*
+ * Gives everything past size back. Only named segments can: they are
+ * truncated in place. A SysV segment keeps the size it was created with,
+ * so 0 is returned for it, as for any segment left as it was.
+ */
+int shm_shrink(shm_t *shm, shm_size_t size)
+{
+	shm_size_t page, keep;
+
+	if (!shm || shm->fd < 0 || size <= 0 || size >= shm->size)
+		return 0;
+
+#if defined (_WIN32) || defined (_WIN64)
+	return 0;
+
+#else
+	page = sysconf(_SC_PAGESIZE);
+	keep = (size + page - 1) / page * page;
+	if (keep >= shm->size)
+		return 0;
+	/* fails on hugetlbfs unless keep is a whole huge page, that's fine */
+	if (ftruncate(shm->fd, keep) < 0)
+		return 0;
+	munmap((unsigned char *) shm->at + keep, shm->size - keep);
+	shm->size = keep;
+	return 1;
+#endif
+}
+
+/*
+ * Makes a writable segment size bytes long, keeping what it holds. Named
+ * segments are extended in place and mapped again; a SysV segment is
+ * copied into a bigger one under the same key, which needs it attached
+ * by nobody else. Either way shm->at moves. Returns 0 if the segment was
+ * left as it was.
+ */
+int shm_grow(shm_t *shm, shm_size_t size)
+{
+	if (!shm || size <= shm->size)
+		return 0;
+
+#if defined (_WIN32) || defined (_WIN64)
+	return 0;
+
+#else
+	void *at;
+
+	if (shm->fd >= 0) {
+		/* fails on hugetlbfs unless size is a whole huge page, that's fine */
+		if (ftruncate(shm->fd, size) < 0) {
+			printf("ftruncate(%s, %lld) error %d\n", shm->name, (long long) size, errno);
+			return 0;
+		}
+		at = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, shm->fd, 0);
+		if (at == MAP_FAILED) {
+			printf("mmap(%s, %lld) error %d\n", shm->name, (long long) size, errno);
+			return 0;
+		}
+		munmap(shm->at, shm->size);
+		shm->at = at;
+		shm->size = size;
+		return 1;
+	}
+
+	struct shmid_ds shminfo;
+	shmid_t shmid;
+
+	/* others attached would keep using the old copy */
+	if (shmctl(shm->shmid, IPC_STAT, &shminfo) < 0 || shminfo.shm_nattch != 1)
+		return 0;
+
+	/* a removed segment stays mapped until shmdt() and frees its key */
+	shmctl(shm->shmid, IPC_RMID, 0);
+	shmid = shmget((key_t)shm->key, size, IPC_CREAT|IPC_EXCL|0666);
+	if (shmid == -1) {
+		printf("shmget error %d\n", errno);
+		return 0;
+	}
+	at = shmat(shmid, (void *) 0, 0);
+	if (at == (void *) -1) {
+		shmctl(shmid, IPC_RMID, 0);
+		return 0;
+	}
+	memcpy(at, shm->at, shm->size);
+	shmdt(shm->at);
+
+	for (int i=0; i<MAX_OPENED_HISTORY; i++) {
+		if (_opened_shmids[i] == shm->shmid) {
+			_opened_shmids[i] = shmid;
+			break;
+		}
+	}
+
+	shm->shmid = shmid;
+	shm->at = at;
+	shm->size = size;
+	return 1;
+#endif
+}
+
+/*
+ * Takes the name or key away, so the next shm_create*() makes a new
+ * segment. Whoever has it mapped, this process included, keeps using it
+ * until shm_del().
+ */
+void shm_remove(shm_t *shm)
+{
+	if (!shm) return;
+
+#if !defined (_WIN32) && !defined (_WIN64)
+	if (shm->fd >= 0) {
+		if (!shm->name[0])
+			return;
+		if (strchr(shm->name + 1, '/'))
+			unlink(shm->name);
+		else
+			shm_unlink(shm->name);
+		return;
+	}
+
+	shmctl(shm->shmid, IPC_RMID, 0);
+#endif
+}
+
+/* frees the pages of a page aligned range, they read back as zeros */
+int shm_discard(shm_t *shm, shm_size_t offset, shm_size_t size)
+{
+	if (!shm || offset < 0 || size <= 0 || offset + size > shm->size)
+		return 0;
+
+#if defined (MADV_REMOVE)
+	/* punches a hole in the shmem object, for every process mapping it */
+	return madvise((unsigned char *) shm->at + offset, size, MADV_REMOVE) == 0;
+#else
+	return 0;
+#endif
+}
+
+/* the pages size bytes at at fall on */
+static void page_range(const void *at, shm_size_t size, unsigned char **start, size_t *length)
+{
+#if defined (_WIN32) || defined (_WIN64)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	uintptr_t page = info.dwPageSize;
+#else
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+#endif
+	uintptr_t begin = (uintptr_t) at & ~(page - 1);
+	uintptr_t end = ((uintptr_t) at + size + page - 1) & ~(page - 1);
+
+	*start = (unsigned char *) begin;
+	*length = end - begin;
+}
+
+/*
+ * Faults in the pages of size bytes at at by reading them, so it works on
+ * a read-only mapping and dirties nothing. With SHM_MLOCK they are locked
+ * as well. Returns 0 if they couldn't be locked.
+ */
+int shm_prefault(const void *at, shm_size_t size, int opt)
+{
+	volatile unsigned char sum = 0;
+	unsigned char *start;
+	size_t length, i;
+
+	if (!at || size <= 0)
+		return 1;
+	page_range(at, size, &start, &length);
+
+#if defined (MADV_WILLNEED)
+	/* starts reading ahead what is still on disk, an image file mostly */
+	madvise(start, length, MADV_WILLNEED);
+#endif
+
+	/* 4K steps, a larger page is simply touched more than once */
+	for (i = 0; i < length; i += 4096)
+		sum += start[i];
+
+	if (!(opt & SHM_MLOCK))
+		return 1;
+#if defined (_WIN32) || defined (_WIN64)
+	return VirtualLock(start, length) != 0;
+#else
+	if (mlock(start, length) < 0) {
+		printf("mlock(%llu) error %d\n", (unsigned long long) length, errno);
+		return 0;
+	}
+	return 1;
+#endif
+}
+
+/* undoes SHM_MLOCK, unmapping does as well */
+void shm_unlock(const void *at, shm_size_t size)
+{
+	unsigned char *start;
+	size_t length;
+
+	if (!at || size <= 0)
+		return;
+	page_range(at, size, &start, &length);
+#if defined (_WIN32) || defined (_WIN64)
+	VirtualUnlock(start, length);
+#else
+	munlock(start, length);
+#endif
+}
+
 void* shm_get(shm_t *shm)
 {
 	if (!shm) return NULL;
 	return shm->at;
 }
 
+/* unmaps, but unlike shm_del() never removes the segment, even if it was the last one attached */
+void shm_close(shm_t *shm)
+{
+	if (!shm) return;
+
+#if defined (_WIN32) || defined (_WIN64)
+	if (shm->at) UnmapViewOfFile(shm->at);
+	if (shm->shmid) CloseHandle(shm->shmid);
+#else
+	if (shm->fd >= 0) {
+		forget_named(shm);
+		if (shm->at) munmap(shm->at, shm->size);
+		close(shm->fd);
+	} else {
+		for (int i=0; i<MAX_OPENED_HISTORY; i++) {
+			if (_opened_shmids[i] == shm->shmid) {
+				_opened_shmids[i] = 0;
+				break;
+			}
+		}
+		if (shm->at) shmdt(shm->at);
+	}
+#endif
+
+	free(shm);
+}
+
 void shm_del(shm_t *shm)
 {
 	if (!shm) return;
@@ -176,6 +590,17 @@ void shm_del(shm_t *shm)
 #else
 	struct shmid_ds shminfo;
 	shmid_t shmid;
+
+	if (shm->fd >= 0) {
+		/* nobody else holds the shared lock, the segment goes with us */
+		forget_named(shm);
+		if (shm->transient && flock(shm->fd, LOCK_EX|LOCK_NB) == 0)
+			shm_remove(shm);
+		if (shm->at) munmap(shm->at, shm->size);
+		close(shm->fd);
+		free(shm);
+		return;
+	}
 	
 	for (int i=0; i<MAX_OPENED_HISTORY; i++) {
 		if (_opened_shmids[i] == shm->shmid) {
@@ -190,7 +615,6 @@ void shm_del(shm_t *shm)
 	}
 
 	if (shm->at) shmdt(shm->at);
-	if (shm->shmid) close(shm->shmid);
 #endif
 
 	free (shm);
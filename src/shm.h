@@ -2,11 +2,31 @@
 #define _SHM_H
 
 
+#include <stdint.h>
+
 /**
  shm_t *shm = _shmcreate(key, BUFFER_SIZE, SHM_READWRITE);
  char *at = (char*)_shmget(shm);
  CopyMemory((PVOID)at, szMsg, (_tcslen(szMsg) * sizeof(TCHAR)));
  _shmdel(shm);
+
+ shm_t *shm = shm_create_named("/jss.items", BUFFER_SIZE, SHM_READWRITE|SHM_HUGEPAGE);
+
+ Named segments are POSIX shared memory (shm_open + mmap) and need no
+ kernel.shmmax/shmall tuning. They outlive the process like files do,
+ until shm_unlink(), unless opened SHM_TRANSIENT: then, like a SysV
+ segment, the last process to shm_del() one removes it, and so does
+ SIGINT in the last process. Every process holds a shared flock() on it
+ to be counted. A name with a directory in it ("/dev/hugepages/jss")
+ is opened as a file, which puts the segment on a hugetlbfs mount. A NULL
+ name creates an anonymous memfd, shared with children only.
+ shm->size is the real size, which can be larger than asked for when the
+ segment already existed. A size of 0 only attaches an existing segment,
+ with either backend.
+
+ shm_prefault() faults the pages of part of a mapping in, so the first
+ reads don't, a piece at a time if the caller wants to report progress,
+ and with SHM_MLOCK also keeps those pages resident.
  */
 
 #if defined (_WIN32) || defined (_WIN64)
@@ -17,23 +37,44 @@ typedef HANDLE	shmid_t;
 typedef __int64 shm_size_t;
 
 #else
+#include <sys/shm.h>
+
 #define SHM_READWRITE	0
 #define SHM_READONLY	SHM_RDONLY
 
 typedef int shmid_t;
-typedef int shm_size_t;
+typedef int64_t shm_size_t;
 #endif
 
+/* huge pages: MAP_HUGETLB/SHM_HUGETLB where possible, THP madvise otherwise */
+#define SHM_HUGEPAGE	0x01000000
+#define SHM_MLOCK		0x04000000		/* shm_prefault() only, needs RLIMIT_MEMLOCK */
+#define SHM_TRANSIENT	0x08000000		/* named: removed with its last user */
+
+#define SHM_NAME_MAX	256
+
 typedef struct shared_memory_t {
 	unsigned int key;
 	void *at;
 	shm_size_t size;
 
 	shmid_t shmid;
+
+	int fd;					/* named segments only, -1 otherwise */
+	int transient;			/* opened SHM_TRANSIENT */
+	char name[SHM_NAME_MAX];
 } shm_t;
 
 shm_t* shm_create(int key, shm_size_t size, int opt);
+shm_t* shm_create_named(const char *name, shm_size_t size, int opt);
+int shm_shrink(shm_t *shm, shm_size_t size);
+int shm_grow(shm_t *shm, shm_size_t size);
+void shm_remove(shm_t *shm);
+int shm_discard(shm_t *shm, shm_size_t offset, shm_size_t size);
+int shm_prefault(const void *at, shm_size_t size, int opt);
+void shm_unlock(const void *at, shm_size_t size);
 void* shm_get(shm_t *shm);
+void shm_close(shm_t *shm);
 void shm_del(shm_t *shm);
 
 #endif
\ No newline at end of file
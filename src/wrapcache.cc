@@ -0,0 +1,122 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wrapcache.h"
+
+#define WRAPCACHE_INITIAL	256
+
+/* records are 8 byte aligned, the low bits carry nothing */
+static inline unsigned int home(const wrapcache_t *cache, int64_t key)
+{
+	return (unsigned int) (((uint64_t) key >> 3) * 0x9E3779B97F4A7C15ULL >> 32) & (cache->size - 1);
+}
+
+wrapcache_t* wrapcache_create()
+{
+	wrapcache_t *cache = NULL;
+
+	for (;;) {
+		cache = (wrapcache_t *) calloc(1, sizeof(wrapcache_t));
+		if (!cache) break;
+
+		cache->entries = (wrapcache_entry_t *) calloc(WRAPCACHE_INITIAL, sizeof(wrapcache_entry_t));
+		if (!cache->entries) break;
+		cache->size = WRAPCACHE_INITIAL;
+		cache->refs = 1;
+
+		return cache;
+	}
+
+	free(cache);
+	return NULL;
+}
+
+void wrapcache_hold(wrapcache_t *cache)
+{
+	if (cache) cache->refs++;
+}
+
+void wrapcache_release(wrapcache_t *cache)
+{
+	if (!cache || --cache->refs > 0)
+		return;
+	free(cache->entries);
+	free(cache);
+}
+
+void* wrapcache_get(const wrapcache_t *cache, int64_t key)
+{
+	unsigned int i;
+
+	for (i = home(cache, key); cache->entries[i].key; i = (i + 1) & (cache->size - 1)) {
+		if (cache->entries[i].key == key)
+			return cache->entries[i].value;
+	}
+	return NULL;
+}
+
+static int grow(wrapcache_t *cache)
+{
+	wrapcache_entry_t *old = cache->entries;
+	unsigned int i, n, size = cache->size;
+
+	cache->entries = (wrapcache_entry_t *) calloc(size * 2, sizeof(wrapcache_entry_t));
+	if (!cache->entries) {
+		cache->entries = old;
+		return 0;
+	}
+	cache->size = size * 2;
+
+	for (i = 0; i < size; i++) {
+		if (!old[i].key)
+			continue;
+		for (n = home(cache, old[i].key); cache->entries[n].key; n = (n + 1) & (cache->size - 1));
+		cache->entries[n] = old[i];
+	}
+	free(old);
+	return 1;
+}
+
+/* replaces what key mapped to; 0 if the table couldn't grow */
+int wrapcache_put(wrapcache_t *cache, int64_t key, void *value)
+{
+	unsigned int i;
+
+	/* keep it at most half full */
+	if ((cache->count + 1) * 2 > cache->size && !grow(cache))
+		return 0;
+
+	for (i = home(cache, key); cache->entries[i].key; i = (i + 1) & (cache->size - 1)) {
+		if (cache->entries[i].key == key) {
+			cache->entries[i].value = value;
+			return 1;
+		}
+	}
+	cache->entries[i].key = key;
+	cache->entries[i].value = value;
+	cache->count++;
+	return 1;
+}
+
+void wrapcache_remove(wrapcache_t *cache, int64_t key, const void *value)
+{
+	unsigned int i, next, h, mask = cache->size - 1;
+
+	for (i = home(cache, key); cache->entries[i].key != key; i = (i + 1) & mask) {
+		if (!cache->entries[i].key)
+			return;
+	}
+	if (cache->entries[i].value != value)
+		return;
+
+	/* backward shift: pull up every entry that probed past the hole */
+	for (next = (i + 1) & mask; cache->entries[next].key; next = (next + 1) & mask) {
+		h = home(cache, cache->entries[next].key);
+		if (((next - h) & mask) >= ((next - i) & mask)) {
+			cache->entries[i] = cache->entries[next];
+			i = next;
+		}
+	}
+	memset(&cache->entries[i], 0, sizeof(wrapcache_entry_t));
+	cache->count--;
+}
@@ -0,0 +1,42 @@
+#ifndef _WRAPCACHE_H
+#define _WRAPCACHE_H
+
+#include <stdint.h>
+
+/**
+ The live wrapper of every record of one dataset, by segment offset.
+
+ wrapcache_t *cache = wrapcache_create();
+ void *wrapper = wrapcache_get(cache, offset);
+ if (!wrapper)
+     wrapcache_put(cache, offset, wrapper = make_wrapper(offset));
+ ...
+ wrapcache_remove(cache, offset, wrapper);		when the wrapper dies
+ wrapcache_release(cache);
+
+ Nothing here keeps a wrapper alive: whoever owns one removes it when it
+ goes. The cache is shared by reference count, the last release frees it.
+ Offsets are never 0, that marks a free slot.
+ */
+
+typedef struct wrapcache_entry_t {
+	int64_t key;
+	void *value;
+} wrapcache_entry_t;
+
+typedef struct wrapcache_t {
+	wrapcache_entry_t *entries;
+	unsigned int size;			/* power of 2 */
+	unsigned int count;
+	int refs;
+} wrapcache_t;
+
+wrapcache_t* wrapcache_create();
+void wrapcache_hold(wrapcache_t *cache);
+void wrapcache_release(wrapcache_t *cache);
+void* wrapcache_get(const wrapcache_t *cache, int64_t key);
+int wrapcache_put(wrapcache_t *cache, int64_t key, void *value);
+/* only if key still maps to value */
+void wrapcache_remove(wrapcache_t *cache, int64_t key, const void *value);
+
+#endif
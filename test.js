@@ -1,6 +1,190 @@
+var assert = require('assert');
 var glob = require('glob');
 var jss = require('./index.js');
 
+// the same JSON for every process of the build-once check below
+function sharedJson() {
+	var items = [];
+	for (var i = 0; i < 200000; i++)
+		items.push({ id: i, s: 'item' + i });
+	return JSON.stringify({ items: items });
+}
+
+// a worker forked by the build-once check: builds, reads, reports, leaves
+if (process.env.JSS_TEST_WORKER) {
+	var shared = jss.createJssByJsonStr(sharedJson());
+	process.send({ length: shared.items.length, last: shared.items[199999].s, middle: shared.items[100000].id }, function () {
+		process.exit(0);
+	});
+	return;
+}
+
+// self-contained checks, run before the staticdata comparison below
+function check(name, fn) {
+	fn();
+	console.info('[OK] ' + name);
+}
+
+check('parser errors', function () {
+	assert.strictEqual(jss.createJssByJsonStr('{"a":'), undefined);
+	assert.strictEqual(jss.createJssByJsonStr('[1,2'), undefined);
+	assert.strictEqual(jss.createJssByJsonStr('{"a" 1}'), undefined);
+	assert.strictEqual(jss.createJssByJsonStr('"abc'), undefined);
+	// a backslash as the very last byte must not read past the input
+	assert.strictEqual(jss.createJssByJsonStr('"abc\\'), undefined);
+	assert.strictEqual(jss.createJssByJsonStr('{"a":"x\\'), undefined);
+	// raw control characters and broken surrogate pairs
+	assert.strictEqual(jss.createJssByJsonStr('["a\u0001"]'), undefined);
+	assert.strictEqual(jss.createJssByJsonStr('["a\tb"]'), undefined);
+	assert.strictEqual(jss.createJssByJsonStr('["\\ud800\\u0041"]'), undefined);
+	assert.strictEqual(jss.createJssByJsonStr('["\\udc00"]'), undefined);
+});
+
+check('packed arrays', function () {
+	var data = jss.createJssByJsonStr('{"list":[1,2.5,"x",null,true,[3],{"y":4}],"empty":[]}');
+	assert.strictEqual(data.list.length, 7);
+	assert.strictEqual(data.empty.length, 0);
+	assert.strictEqual(data.list[1], 2.5);
+	assert.strictEqual(data.list[3], null);
+	assert.strictEqual(data.list[5][0], 3);
+	assert.strictEqual(data.list[6].y, 4);
+	assert.strictEqual(data.list[7], undefined);
+	assert.strictEqual(jss.createJssByJsonStr('[4,5,6]').length, 3);
+});
+
+check('lazy views', function () {
+	var data = jss.createJssByJsonStr('{"row":{"x":{"a":1},"list":[1,2,3]}}');
+	var row = data.row;
+	assert.strictEqual(row.x, row.x);
+	assert.strictEqual(data.row, row);
+	assert.ok(row.list instanceof Array);
+	assert.deepEqual(row.list.map(function (v) { return v * 2; }), [2, 4, 6]);
+	// keys come in hash slot order
+	assert.deepEqual(Object.keys(row).sort(), ['list', 'x']);
+});
+
+check('inline and long strings', function () {
+	var source = {
+		empty: '',
+		short: 'abcdefg',
+		wide: '\u00e9\u00e8',
+		ascii: new Array(65).join('ab'),
+		utf8: new Array(33).join('\uac00\u00e9'),
+		pair: new Array(40).join('\ud83d\ude00')
+	};
+	var data = jss.createJssByJsonStr(JSON.stringify(source));
+	for (var key in source)
+		assert.strictEqual(data[key], source[key], key);
+});
+
+check('get and compilePath', function () {
+	var data = jss.createJssByJsonStr('{"monsters":[{"drops":[{"itemId":7}]},{"drops":[{"itemId":8},{"itemId":9}]}]}');
+	var drop = jss.compilePath('monsters[*].drops[*].itemId');
+	assert.strictEqual(jss.get(data, 'monsters[1].drops[1].itemId'), 9);
+	assert.strictEqual(jss.get(data, drop, 0, 0), 7);
+	assert.strictEqual(jss.get(data, drop, 1, 1), 9);
+	assert.strictEqual(jss.get(data.monsters, '[1].drops[0].itemId'), 8);
+	assert.strictEqual(jss.get(data, 'monsters[5].drops'), undefined);
+	assert.throws(function () { jss.compilePath('monsters['); });
+	assert.throws(function () { jss.compilePath('monsters..drops'); });
+	assert.throws(function () { jss.get(data, 'a[x]'); });
+	assert.throws(function () { jss.get(data, drop, 1); });
+});
+
+check('image round trip', function () {
+	var file = require('os').tmpdir() + '/jss.test.' + process.pid + '.img';
+	var data = jss.createJssByJsonStr('{"a":[1,2,{"b":"' + new Array(80).join('c') + '"}],"d":"e"}');
+	assert.ok(jss.saveJssImage(data, file));
+	try {
+		var image = jss.createJssByImageFile(file);
+		assert.strictEqual(image.a.length, 3);
+		assert.strictEqual(image.a[1], 2);
+		assert.strictEqual(image.a[2].b, new Array(80).join('c'));
+		assert.strictEqual(image.d, 'e');
+	} finally {
+		require('fs').unlinkSync(file);
+	}
+});
+
+check('named datasets', function () {
+	var name = 'test.named.' + process.pid;
+	var source = { list: [1, 'two', { three: 3 }], flag: true, text: new Array(50).join('xy') };
+	assert.ok(jss.createJssByJsonStr(JSON.stringify(source), { name: name }));
+	var data = jss.open(name);
+	assert.ok(data);
+	assert.strictEqual(data.list.length, 3);
+	assert.strictEqual(data.list[0], 1);
+	assert.strictEqual(data.list[1], 'two');
+	assert.strictEqual(data.list[2].three, 3);
+	assert.strictEqual(data.flag, true);
+	assert.strictEqual(data.text, source.text);
+	assert.strictEqual(jss.open('test.no-such-name.' + process.pid), undefined);
+});
+
+check('republishing a name', function () {
+	var name = 'test.republish.' + process.pid;
+	assert.ok(jss.createJssByJsonStr('{"row":{"v":1,"s":"old"}}', { name: name }));
+	var root = jss.open(name);
+	var row = root.row;
+	assert.strictEqual(row.v, 1);
+	assert.ok(jss.createJssByJsonStr('{"row":{"v":2,"s":"new"},"added":true}', { name: name }));
+	// the root follows the name, what was read from it stays put
+	assert.strictEqual(root.row.v, 2);
+	assert.strictEqual(root.row.s, 'new');
+	assert.strictEqual(root.added, true);
+	assert.strictEqual(row.v, 1);
+	assert.strictEqual(row.s, 'old');
+	assert.strictEqual(jss.open(name).row.v, 2);
+});
+
+check('registry list', function () {
+	var name = 'test.list.' + process.pid;
+	var data = jss.createJssByJsonStr('{"a":1}', { name: name });
+	var segment = jss.createJssByJsonStr('{"b":' + process.pid + '}');
+	var listed = jss.list().filter(function (item) {
+		return item.type === 'dataset' && item.name === name;
+	});
+	assert.strictEqual(listed.length, 1);
+	assert.ok(listed[0].current);
+	assert.ok(listed[0].size > 0);
+	assert.notStrictEqual(listed[0].owners.indexOf(process.pid), -1);
+	assert.ok(jss.list().some(function (item) {
+		return item.type === 'segment' && item.owners.indexOf(process.pid) !== -1;
+	}));
+	assert.strictEqual(data.a, 1);
+	assert.strictEqual(segment.b, process.pid);
+});
+
+// several processes build the same JSON at once: one builds, the rest wait
+// for it and map the result. The first one is killed early, and whoever
+// is left takes the build over if it was the builder
+(function () {
+	var fork = require('child_process').fork;
+	var workers = 4, pending = workers, reports = [];
+
+	for (var i = 0; i < workers; i++) {
+		var env = {};
+		for (var key in process.env)
+			env[key] = process.env[key];
+		env.JSS_TEST_WORKER = '1';
+		var worker = fork(__filename, [], { env: env });
+		worker.on('message', function (report) {
+			reports.push(report);
+		});
+		worker.on('exit', function () {
+			if (--pending)
+				return;
+			assert.ok(reports.length >= workers - 1);
+			reports.forEach(function (report) {
+				assert.deepEqual(report, { length: 200000, last: 'item199999', middle: 100000 });
+			});
+			console.info('[OK] build once across processes');
+		});
+		if (!i)
+			setTimeout(worker.kill.bind(worker, 'SIGKILL'), 50);
+	}
+})();
+
 var errorcount = 0;
 function touchall(object1, object2, level) {
 	if (!level) level = 1;